@@ -8,29 +8,40 @@ in vec3 v_cam_dir;
 in vec3 v_vertex_world_pos;
 out vec4 fragColor;
 
-uniform vec3 u_cam_pos;
-
-//basic material uniforms
-uniform vec3 u_ambient;
-uniform vec3 u_diffuse;
-uniform vec3 u_specular;
-uniform float u_specular_gloss;
+//material parameters, one block per material (see MaterialUniformData)
+layout(std140) uniform MaterialData {
+	vec3 u_ambient;
+	float u_specular_gloss;
+	vec3 u_diffuse;
+	int u_use_diffuse_map;
+	vec3 u_specular;
+	int u_use_reflection_map;
+	float u_opacity;
+};
 
 //texture uniforms
-uniform int u_use_diffuse_map;
 uniform sampler2D u_diffuse_map;
-
-uniform int u_use_reflection_map;
 uniform samplerCube u_skybox;
 
-//light structs and uniforms
-struct PointLight {
-    vec3 position;
-    vec3 color;
+//per-frame camera and light data, shared by all shaders (see FrameUniformData)
+struct Light {
+	vec3 position;
+	float linear_att;
+	vec3 direction;
+	float quadratic_att;
+	vec3 color;
+	float spot_inner_cosine;
+	float spot_outer_cosine;
+	int type; // 0 - directional; 1 - point; 2 - spot
 };
 const int MAX_LIGHTS = 8;
-uniform PointLight lights[MAX_LIGHTS];
-uniform int u_num_lights;
+layout(std140) uniform FrameData {
+	mat4 u_view;
+	mat4 u_projection;
+	vec3 u_cam_pos;
+	int u_num_lights;
+	Light lights[MAX_LIGHTS];
+};
 
 
 void main(){
@@ -76,5 +87,5 @@ void main(){
         final_color += diffuse_color + specular_color;
     }
     
-    fragColor = vec4(final_color, 1.0);
+    fragColor = vec4(final_color, u_opacity);
 }
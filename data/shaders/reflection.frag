@@ -6,7 +6,26 @@ in vec3 v_normal;
 in vec3 v_vertex_world_pos;
 out vec4 fragColor;
 
-uniform vec3 u_cam_pos;
+//per-frame camera and light data, shared by all shaders (see FrameUniformData)
+struct Light {
+	vec3 position;
+	float linear_att;
+	vec3 direction;
+	float quadratic_att;
+	vec3 color;
+	float spot_inner_cosine;
+	float spot_outer_cosine;
+	int type; // 0 - directional; 1 - point; 2 - spot
+};
+const int MAX_LIGHTS = 8;
+layout(std140) uniform FrameData {
+	mat4 u_view;
+	mat4 u_projection;
+	vec3 u_cam_pos;
+	int u_num_lights;
+	Light lights[MAX_LIGHTS];
+};
+
 uniform samplerCube u_skybox; 
 
 
@@ -4,9 +4,29 @@ layout(location = 0) in vec3 a_vertex;
 layout(location = 1) in vec2 a_uv;
 layout(location = 2) in vec3 a_normal;
 
-uniform mat4 u_mvp;
-uniform mat4 u_model;
-uniform mat4 u_normal_matrix;
+//per-instance matrices, from the instance buffer (see InstanceData)
+layout(location = 3) in mat4 a_model;
+layout(location = 7) in mat4 a_normal_matrix;
+
+//per-frame camera and light data, shared by all shaders (see FrameUniformData)
+struct Light {
+	vec3 position;
+	float linear_att;
+	vec3 direction;
+	float quadratic_att;
+	vec3 color;
+	float spot_inner_cosine;
+	float spot_outer_cosine;
+	int type; // 0 - directional; 1 - point; 2 - spot
+};
+const int MAX_LIGHTS = 8;
+layout(std140) uniform FrameData {
+	mat4 u_view;
+	mat4 u_projection;
+	vec3 u_cam_pos;
+	int u_num_lights;
+	Light lights[MAX_LIGHTS];
+};
 
 
 out vec2 v_uv;
@@ -18,12 +38,12 @@ void main(){
 
 	v_uv = a_uv;
 	//rotate normal 
-	v_normal = (u_normal_matrix * vec4(a_normal, 1.0)).xyz;
+	v_normal = (a_normal_matrix * vec4(a_normal, 1.0)).xyz;
 
 	//calculate world position of current vertex
-	v_vertex_world_pos = (u_model * vec4(a_vertex, 1.0)).xyz;
+	v_vertex_world_pos = (a_model * vec4(a_vertex, 1.0)).xyz;
 
 
 
-	gl_Position = u_mvp * vec4(a_vertex, 1.0);
+	gl_Position = u_projection * u_view * vec4(v_vertex_world_pos, 1.0);
 }
\ No newline at end of file
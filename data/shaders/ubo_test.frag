@@ -5,11 +5,16 @@ in vec3 v_normal;
 
 out vec4 fragColor;
 
-struct TestStruct {
-	vec3 color_a;
-	vec3 color_b;
+//material parameters, one block per material (see MaterialUniformData)
+layout(std140) uniform MaterialData {
+	vec3 u_ambient;
+	float u_specular_gloss;
+	vec3 u_diffuse;
+	int u_use_diffuse_map;
+	vec3 u_specular;
+	int u_use_reflection_map;
+	float u_opacity;
 };
-uniform TestStruct u_test_struct;
 
 
 void main(){
@@ -18,8 +23,8 @@ void main(){
 
 	float col_f = sin(v_normal.x);
 	
-	vec3 final_color = mix(u_test_struct.color_a, u_test_struct.color_b, col_f);
+	vec3 final_color = mix(u_diffuse, u_specular, col_f);
 
 
-	fragColor = vec4(final_color, 1.0);
+	fragColor = vec4(final_color, u_opacity);
 }
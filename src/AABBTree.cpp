@@ -0,0 +1,240 @@
+#include "AABBTree.h"
+
+using namespace lm;
+
+// ****** BOX HELPERS ***** //
+
+static vec3 minVec3(const vec3& a, const vec3& b) {
+	return vec3(a.x < b.x ? a.x : b.x, a.y < b.y ? a.y : b.y, a.z < b.z ? a.z : b.z);
+}
+
+static vec3 maxVec3(const vec3& a, const vec3& b) {
+	return vec3(a.x > b.x ? a.x : b.x, a.y > b.y ? a.y : b.y, a.z > b.z ? a.z : b.z);
+}
+
+//half the surface area, which is all the insertion cost needs
+static float boxArea(const vec3& min, const vec3& max) {
+	vec3 d = max - min;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+static bool boxContains(const vec3& outer_min, const vec3& outer_max, const vec3& min, const vec3& max) {
+	return outer_min.x <= min.x && outer_min.y <= min.y && outer_min.z <= min.z &&
+		max.x <= outer_max.x && max.y <= outer_max.y && max.z <= outer_max.z;
+}
+
+// ****** PUBLIC ***** //
+
+int AABBTree::insert(const vec3& min, const vec3& max, int user_data) {
+	int proxy = allocateNode_();
+	vec3 fat(margin, margin, margin);
+	nodes_[proxy].min = min - fat;
+	nodes_[proxy].max = max + fat;
+	nodes_[proxy].user_data = user_data;
+	nodes_[proxy].height = 0;
+	insertLeaf_(proxy);
+	return proxy;
+}
+
+void AABBTree::remove(int proxy) {
+	removeLeaf_(proxy);
+	freeNode_(proxy);
+}
+
+bool AABBTree::move(int proxy, const vec3& min, const vec3& max) {
+	if (boxContains(nodes_[proxy].min, nodes_[proxy].max, min, max))
+		return false;
+
+	removeLeaf_(proxy);
+	vec3 fat(margin, margin, margin);
+	nodes_[proxy].min = min - fat;
+	nodes_[proxy].max = max + fat;
+	insertLeaf_(proxy);
+	return true;
+}
+
+// ****** NODES ***** //
+
+//reuses a node from the free list, or adds one
+int AABBTree::allocateNode_() {
+	if (free_list_ == -1) {
+		nodes_.emplace_back();
+		return (int)nodes_.size() - 1;
+	}
+	int node = free_list_;
+	free_list_ = nodes_[node].parent;
+	nodes_[node] = AABBTreeNode();
+	return node;
+}
+
+void AABBTree::freeNode_(int node) {
+	nodes_[node].parent = free_list_;
+	nodes_[node].height = -1;
+	free_list_ = node;
+}
+
+//descends from the root choosing the child which increases total area least,
+//then pairs the leaf with the node found under a new parent
+void AABBTree::insertLeaf_(int leaf) {
+	if (root_ == -1) {
+		root_ = leaf;
+		nodes_[root_].parent = -1;
+		return;
+	}
+
+	vec3 leaf_min = nodes_[leaf].min;
+	vec3 leaf_max = nodes_[leaf].max;
+	int index = root_;
+	while (!nodes_[index].isLeaf()) {
+		int left = nodes_[index].left;
+		int right = nodes_[index].right;
+
+		float area = boxArea(nodes_[index].min, nodes_[index].max);
+		float combined_area = boxArea(minVec3(nodes_[index].min, leaf_min), maxVec3(nodes_[index].max, leaf_max));
+
+		//cost of creating a new parent for this node and the new leaf
+		float cost = 2.0f * combined_area;
+		//minimum cost of pushing the leaf further down the tree
+		float inheritance_cost = 2.0f * (combined_area - area);
+
+		//cost of descending into each child
+		float child_cost[2];
+		int children[2] = { left, right };
+		for (int k = 0; k < 2; k++) {
+			const AABBTreeNode& child = nodes_[children[k]];
+			float new_area = boxArea(minVec3(child.min, leaf_min), maxVec3(child.max, leaf_max));
+			if (child.isLeaf())
+				child_cost[k] = new_area + inheritance_cost;
+			else
+				child_cost[k] = new_area - boxArea(child.min, child.max) + inheritance_cost;
+		}
+
+		if (cost < child_cost[0] && cost < child_cost[1])
+			break;
+		index = child_cost[0] < child_cost[1] ? left : right;
+	}
+
+	//create new parent for sibling and leaf
+	int sibling = index;
+	int old_parent = nodes_[sibling].parent;
+	int new_parent = allocateNode_();
+	nodes_[new_parent].parent = old_parent;
+	nodes_[new_parent].min = minVec3(leaf_min, nodes_[sibling].min);
+	nodes_[new_parent].max = maxVec3(leaf_max, nodes_[sibling].max);
+	nodes_[new_parent].height = nodes_[sibling].height + 1;
+	nodes_[new_parent].left = sibling;
+	nodes_[new_parent].right = leaf;
+	nodes_[sibling].parent = new_parent;
+	nodes_[leaf].parent = new_parent;
+
+	if (old_parent == -1) {
+		root_ = new_parent;
+	}
+	else {
+		if (nodes_[old_parent].left == sibling)
+			nodes_[old_parent].left = new_parent;
+		else
+			nodes_[old_parent].right = new_parent;
+	}
+
+	fixUpwards_(nodes_[leaf].parent);
+}
+
+//removes leaf and its parent, whose place is taken by the leaf's sibling
+void AABBTree::removeLeaf_(int leaf) {
+	if (leaf == root_) {
+		root_ = -1;
+		return;
+	}
+
+	int parent = nodes_[leaf].parent;
+	int grand_parent = nodes_[parent].parent;
+	int sibling = nodes_[parent].left == leaf ? nodes_[parent].right : nodes_[parent].left;
+
+	if (grand_parent == -1) {
+		root_ = sibling;
+		nodes_[sibling].parent = -1;
+		freeNode_(parent);
+		return;
+	}
+
+	if (nodes_[grand_parent].left == parent)
+		nodes_[grand_parent].left = sibling;
+	else
+		nodes_[grand_parent].right = sibling;
+	nodes_[sibling].parent = grand_parent;
+	freeNode_(parent);
+
+	fixUpwards_(grand_parent);
+}
+
+//walks up to the root, rebalancing and refitting boxes and heights
+void AABBTree::fixUpwards_(int index) {
+	while (index != -1) {
+		index = balance_(index);
+
+		int left = nodes_[index].left;
+		int right = nodes_[index].right;
+		nodes_[index].height = 1 + (nodes_[left].height > nodes_[right].height ? nodes_[left].height : nodes_[right].height);
+		nodes_[index].min = minVec3(nodes_[left].min, nodes_[right].min);
+		nodes_[index].max = maxVec3(nodes_[left].max, nodes_[right].max);
+
+		index = nodes_[index].parent;
+	}
+}
+
+//if one child of node A is more than one level taller than the other, the
+//taller child is rotated up into A's place. Returns index of the node now in A's place
+int AABBTree::balance_(int a) {
+	AABBTreeNode& A = nodes_[a];
+	if (A.isLeaf() || A.height < 2)
+		return a;
+
+	int b = A.left;
+	int c = A.right;
+	int balance = nodes_[c].height - nodes_[b].height;
+
+	//rotate the taller child up. The code is the same for both sides
+	//with the roles of the children swapped
+	if (balance > 1 || balance < -1) {
+		int up = balance > 1 ? c : b; //child rotated up
+		int other = balance > 1 ? b : c;
+		AABBTreeNode& U = nodes_[up];
+		int f = U.left;
+		int g = U.right;
+
+		//swap A and U
+		U.left = a;
+		U.parent = A.parent;
+		A.parent = up;
+
+		//A's old parent should point to U
+		if (U.parent != -1) {
+			if (nodes_[U.parent].left == a)
+				nodes_[U.parent].left = up;
+			else
+				nodes_[U.parent].right = up;
+		}
+		else {
+			root_ = up;
+		}
+
+		//taller grandchild stays with U, the shorter one moves to A
+		int keep = nodes_[f].height > nodes_[g].height ? f : g;
+		int give = keep == f ? g : f;
+		U.right = keep;
+		if (balance > 1) A.right = give;
+		else A.left = give;
+		nodes_[give].parent = a;
+
+		A.min = minVec3(nodes_[other].min, nodes_[give].min);
+		A.max = maxVec3(nodes_[other].max, nodes_[give].max);
+		A.height = 1 + (nodes_[other].height > nodes_[give].height ? nodes_[other].height : nodes_[give].height);
+		U.min = minVec3(A.min, nodes_[keep].min);
+		U.max = maxVec3(A.max, nodes_[keep].max);
+		U.height = 1 + (A.height > nodes_[keep].height ? A.height : nodes_[keep].height);
+		return up;
+	}
+
+	return a;
+}
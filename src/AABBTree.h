@@ -0,0 +1,155 @@
+#pragma once
+#include "linmath.h"
+#include <vector>
+
+//node of an AABBTree. Leaves store a fattened box around a user object,
+//internal nodes the union of their children
+struct AABBTreeNode {
+	lm::vec3 min;
+	lm::vec3 max;
+	int parent = -1; //also next free node when in free list
+	int left = -1;
+	int right = -1;
+	int height = -1; //0 for leaves, -1 for free nodes
+	int user_data = -1;
+	bool isLeaf() const { return left == -1; }
+};
+
+//dynamic bounding volume tree, kept balanced with rotations (as in Box2D's
+//b2DynamicTree). Leaves are fattened by a margin, so objects which move a
+//little don't need to be reinserted
+class AABBTree {
+public:
+	//margin added to each side of leaf boxes
+	float margin = 0.1f;
+
+	//adds a box and returns its proxy id, used to move or remove it
+	int insert(const lm::vec3& min, const lm::vec3& max, int user_data);
+	void remove(int proxy);
+	//updates box of proxy. It is only reinserted if the box leaves the fat box.
+	//returns true if reinserted
+	bool move(int proxy, const lm::vec3& min, const lm::vec3& max);
+
+	int getUserData(int proxy) const { return nodes_[proxy].user_data; }
+	void setUserData(int proxy, int user_data) { nodes_[proxy].user_data = user_data; }
+	int getHeight() const { return root_ == -1 ? 0 : nodes_[root_].height; }
+	const lm::vec3& getFatMin(int proxy) const { return nodes_[proxy].min; }
+	const lm::vec3& getFatMax(int proxy) const { return nodes_[proxy].max; }
+
+	//calls callback(user_data) for each leaf whose box overlaps min - max
+	template<typename F>
+	void query(const lm::vec3& min, const lm::vec3& max, F callback) const {
+		if (root_ == -1) return;
+		int stack[STACK_SIZE];
+		int stack_size = 0;
+		stack[stack_size++] = root_;
+		while (stack_size > 0) {
+			const AABBTreeNode& node = nodes_[stack[--stack_size]];
+			if (node.max.x < min.x || node.min.x > max.x ||
+				node.max.y < min.y || node.min.y > max.y ||
+				node.max.z < min.z || node.min.z > max.z)
+				continue;
+			if (node.isLeaf()) {
+				callback(node.user_data);
+			}
+			else {
+				stack[stack_size++] = node.left;
+				stack[stack_size++] = node.right;
+			}
+		}
+	}
+
+	//walks the tree with classify(min, max), which returns -1 for a box outside
+	//the query volume, 1 for one inside it and 0 for one crossing its boundary.
+	//Calls callback(user_data, inside) for each leaf which isn't outside.
+	//Subtrees inside the volume are reported without classifying their boxes
+	template<typename C, typename F>
+	void traverse(C classify, F callback) const {
+		if (root_ == -1) return;
+		int stack[STACK_SIZE];
+		bool stack_inside[STACK_SIZE];
+		int stack_size = 0;
+		stack[stack_size] = root_;
+		stack_inside[stack_size++] = false;
+		while (stack_size > 0) {
+			stack_size--;
+			const AABBTreeNode& node = nodes_[stack[stack_size]];
+			bool inside = stack_inside[stack_size];
+			if (!inside) {
+				int side = classify(node.min, node.max);
+				if (side < 0) continue;
+				inside = side > 0;
+			}
+			if (node.isLeaf()) {
+				callback(node.user_data, inside);
+			}
+			else {
+				stack[stack_size] = node.left;
+				stack_inside[stack_size++] = inside;
+				stack[stack_size] = node.right;
+				stack_inside[stack_size++] = inside;
+			}
+		}
+	}
+
+	//calls callback(user_data, max_distance) for each leaf whose box is hit by
+	//the ray from origin along dir, no further than max_distance (measured in
+	//lengths of dir). The callback returns the new max_distance, so once a hit
+	//is found, nodes further away are skipped. Returning 0 stops the query
+	template<typename F>
+	void raycast(const lm::vec3& origin, const lm::vec3& dir, float max_distance, F callback) const {
+		if (root_ == -1) return;
+		lm::vec3 inv_dir(1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z);
+		int stack[STACK_SIZE];
+		int stack_size = 0;
+		stack[stack_size++] = root_;
+		while (stack_size > 0) {
+			const AABBTreeNode& node = nodes_[stack[--stack_size]];
+			if (!rayHitsBox_(origin, inv_dir, max_distance, node.min, node.max))
+				continue;
+			if (node.isLeaf()) {
+				max_distance = callback(node.user_data, max_distance);
+				if (max_distance <= 0.0f) return;
+			}
+			else {
+				stack[stack_size++] = node.left;
+				stack[stack_size++] = node.right;
+			}
+		}
+	}
+
+private:
+	//tree is height balanced, so the traversal stack never grows beyond
+	//height + 1, which is far less than this for any number of leaves that fit in memory
+	static const int STACK_SIZE = 256;
+
+	std::vector<AABBTreeNode> nodes_;
+	int root_ = -1;
+	int free_list_ = -1;
+
+	int allocateNode_();
+	void freeNode_(int node);
+	void insertLeaf_(int leaf);
+	void removeLeaf_(int leaf);
+	int balance_(int node);
+	void fixUpwards_(int node);
+
+	static bool rayHitsBox_(const lm::vec3& origin, const lm::vec3& inv_dir, float max_distance, const lm::vec3& min, const lm::vec3& max) {
+		float t_min = 0.0f;
+		float t_max = max_distance;
+		const float o[3] = { origin.x, origin.y, origin.z };
+		const float id[3] = { inv_dir.x, inv_dir.y, inv_dir.z };
+		const float mn[3] = { min.x, min.y, min.z };
+		const float mx[3] = { max.x, max.y, max.z };
+		for (int k = 0; k < 3; k++) {
+			float t1 = (mn[k] - o[k]) * id[k];
+			float t2 = (mx[k] - o[k]) * id[k];
+			if (t1 > t2) { float tmp = t1; t1 = t2; t2 = tmp; }
+			//NaN from 0 * inf (ray in slab plane) is ignored by these comparisons
+			if (t1 > t_min) t_min = t1;
+			if (t2 < t_max) t_max = t2;
+			if (t_min > t_max) return false;
+		}
+		return true;
+	}
+};
@@ -1,5 +1,9 @@
 #include "CollisionSystem.h"
 #include "extern.h"
+#include "Parsers.h"
+#include <algorithm>
+#include <cfloat>
+#include <fstream>
 
 using namespace lm;
 
@@ -9,9 +13,9 @@ void CollisionSystem::init() {
 }
 
 void CollisionSystem::update(float dt) {
-    //necesary variables
-    lm::vec3 col_point;
-    
+    //bring world space shapes up to date
+    updateColliderWorldData_();
+
     //reset all collisions every frame
     auto& colliders = ECS.getAllComponents<Collider>();
     for (auto& col : colliders){
@@ -20,36 +24,120 @@ void CollisionSystem::update(float dt) {
         col.other = -1;
     }
     
-    //test ray-box collision. This works by looping over ray colliders. For each one, we loop over box colliders
-    //test collision between ray and box, updating collision distance for each collision found
-    //then for future collision tests only look as far as existing stored collision distance
-    for (size_t i = 0; i < colliders.size(); i++) {
-        
+    //test ray collision. This works by looping over ray colliders. For each one, we query the shape tree
+    //and test collision between ray and each box, sphere or mesh found, updating collision distance for each collision found
+    //then for future collision tests only look as far as existing stored collision distance.
+    //Rays are tested in parallel, each recording its hits in order. Hits are then applied to
+    //the colliders serially, in the same order as a single threaded loop
+    ray_hits_.resize(colliders.size());
+    JOBS.parallelFor(colliders, RAY_CHUNK, [this](Collider& ray, size_t i) {
+        std::vector<RayHit>& hits = ray_hits_[i];
+        hits.clear();
         //if collider is ray
-        if (colliders[i].collider_type == ColliderTypeRay) {
-            
-            //test all other colliders
-            for (size_t j = 0; j < colliders.size(); j++) {
-                if (j == i) continue; // no self-test
-                
-                //if box
-                if (colliders[j].collider_type == ColliderTypeBox) {
-                    //test collision
-                    float col_distance = 0; //temp var to store distance
-                    if (intersectSegmentBox(colliders[i], //the ray
-                                            colliders[j], //the box
-                                            col_point, //reference to collision point
-                                            col_distance, //reference to collision distance
-                                            colliders[i].collision_distance)){ //only look as far as current nearest collider
-                        colliders[i].colliding = colliders[j].colliding = true;
-						colliders[i].other = (int)j; colliders[j].other = (int)i;
-                        colliders[i].collision_point = colliders[j].collision_point = col_point;
-                        colliders[i].collision_distance = colliders[j].collision_distance = col_distance;
-                    }
-                }
-            }
+        if (ray.collider_type != ColliderTypeRay) return;
+        
+        //only look as far as current nearest collider
+        ColliderWorldData& ray_world = world_data_[i];
+        traceRay_(ray_world.origin, ray_world.ray_direction, ray.max_distance, ray.collision_distance, (int)i, hits);
+    });
+    
+    for (size_t i = 0; i < colliders.size(); i++) {
+        for (auto& hit : ray_hits_[i]) {
+            size_t j = hit.box;
+            colliders[i].colliding = colliders[j].colliding = true;
+            colliders[i].other = colliders[j].owner; colliders[j].other = colliders[i].owner;
+            colliders[i].collision_point = colliders[j].collision_point = hit.point;
+            colliders[i].collision_distance = colliders[j].collision_distance = hit.distance;
         }
     }
+    
+    //contacts between boxes and spheres
+    updateContacts_();
+}
+
+// Traces many rays at once against box, sphere and mesh colliders, writing the nearest hit of each.
+// Rays are ordered by direction octant, so each chunk walks similar tree paths,
+// then traced in parallel chunks
+void CollisionSystem::raycastBatch(const Ray* rays, Hit* hits, size_t count) {
+    std::vector<int> order(count);
+    for (size_t i = 0; i < count; i++) order[i] = (int)i;
+    auto octant = [rays](int i) {
+        const vec3& d = rays[i].direction;
+        return (d.x < 0.0f ? 1 : 0) | (d.y < 0.0f ? 2 : 0) | (d.z < 0.0f ? 4 : 0);
+    };
+    std::stable_sort(order.begin(), order.end(), [&octant](int a, int b) {
+        return octant(a) < octant(b);
+    });
+    
+    JOBS.parallelFor(count, RAY_CHUNK, [this, rays, hits, &order](size_t begin, size_t end) {
+        std::vector<RayHit> ray_hits;
+        for (size_t k = begin; k < end; k++) {
+            int i = order[k];
+            Hit& hit = hits[i];
+            hit = Hit();
+            traceRay_(rays[i].origin, rays[i].direction, rays[i].max_distance, rays[i].max_distance, -1, ray_hits);
+            //hits are found in order of decreasing distance, so the last one is nearest
+            if (ray_hits.empty()) continue;
+            const RayHit& nearest = ray_hits.back();
+            hit.hit = true;
+            hit.collider = nearest.box;
+            hit.entity = ECS.getAllComponents<Collider>()[nearest.box].owner;
+            hit.point = nearest.point;
+            hit.distance = nearest.distance;
+        }
+    });
+}
+
+// Traces one ray through the shape tree, recording every box, sphere or mesh hit
+// nearer than the hits before it. self is a collider index to skip, or -1
+void CollisionSystem::traceRay_(const vec3& origin, const vec3& direction, float max_distance, float nearest, int self, std::vector<RayHit>& hits) {
+    hits.clear();
+    float query_distance = max_distance < nearest ? max_distance : nearest;
+    
+    //segment is only tested as far as the ray reaches
+    vec3 p = origin;
+    vec3 pq = direction * max_distance;
+    
+    //boxes found by the tree are tested in packets of four. Lanes are resolved in the
+    //order found, so hits are recorded exactly as if each box were tested on its own.
+    //Spheres are tested on their own, once boxes found before them are done
+    int packet[4];
+    int packet_size = 0;
+    auto addHit = [&](int j, float t) {
+        RayHit hit;
+        hit.box = j;
+        hit.point = p + pq * t;
+        hit.distance = (p - hit.point).length();
+        if (hit.distance > nearest) return;
+        nearest = hit.distance;
+        hits.push_back(hit);
+    };
+    auto flushPacket = [&]() {
+        for (int lane = packet_size; lane < 4; lane++) packet[lane] = packet[0];
+        float t[4];
+        int mask = intersectSegmentBoxes4_(p, pq, packet, t);
+        for (int lane = 0; lane < packet_size; lane++)
+            if (mask & (1 << lane)) addHit(packet[lane], t[lane]);
+        packet_size = 0;
+    };
+    
+    //test boxes whose tree nodes the ray passes through, skipping those beyond the nearest hit
+    shape_tree_.raycast(origin, direction, query_distance, [&](int j, float tree_distance) {
+        if (j == self) return tree_distance; // no self-test
+        ColliderType type = world_data_[j].collider_type;
+        if (type == ColliderTypeSphere || type == ColliderTypeMesh) {
+            float t;
+            if (packet_size > 0) flushPacket();
+            bool hit = type == ColliderTypeSphere ? intersectSegmentSphere_(p, pq, j, t) : intersectSegmentMesh_(p, pq, j, t);
+            if (hit) addHit(j, t);
+        }
+        else {
+            packet[packet_size++] = j;
+            if (packet_size == 4) flushPacket();
+        }
+        return max_distance < nearest ? max_distance : nearest;
+    });
+    if (packet_size > 0) flushPacket();
 }
 
 // Calculates whether a Ray collider (treated as a segment with a finite distance)
@@ -61,105 +149,338 @@ void CollisionSystem::update(float dt) {
 // - optional variable which specifies the maximum distance along ray which to search
 bool CollisionSystem::intersectSegmentBox(Collider& ray, Collider& box, lm::vec3& col_point, float& col_distance, float max_distance) {
     //the general approach of this function is as follows
-    // - transform ray and box into world space and apply any offsets
-    // - create six planes of box
-    // - calculate collision of ray with each plane
-    // note that there is an inherent optimization in that the intersectSegmentQuad
-    // function already discards cases where ray points in same direction as quad
-    // normal, so in fact we only test collisions for maximum 3 faces
-    
-    //get model matrices
-    Transform& ray_model = ECS.getComponentFromEntity<Transform>(ray.owner);
-    Transform& box_model = ECS.getComponentFromEntity<Transform>(box.owner);
-    //get reference to all transforms in ECS, for world pos calculations
-    std::vector<Transform>& all_transforms = ECS.getAllComponents<Transform>();
-    
-    //*** TRANSFORM BOX TO WORLD ***//
-    //get world matrices from scene graph
-    mat4 box_global = box_model.getGlobalMatrix(all_transforms);
-    
-    //get each corner of box in local space
-    float x = box.local_halfwidth.x;
-    float y = box.local_halfwidth.y;
-    float z = box.local_halfwidth.z;
-    vec3 off = box.local_center;
-    vec3 a( -x,   y,  z);
-    vec3 b( -x,  -y,  z);
-    vec3 c(  x,  -y,  z);
-    vec3 d(  x,   y,  z);
-    vec3 e( -x,   y,  -z);
-    vec3 f( -x,  -y,  -z);
-    vec3 g(  x,  -y,  -z);
-    vec3 h(  x,   y,  -z);
-    
-    //move center
-    a = a + off; b = b + off; c = c + off; d = d + off;
-    e = e + off; f = f + off; g = g + off; h = h + off;
-    
-    //multiply by model matrix
-    a = box_global * a; b = box_global * b; c = box_global * c; d = box_global * d;
-    e = box_global * e; f = box_global * f; g = box_global * g; h = box_global * h;
-    
-    
-    //*** TRANSFORM RAY TO WORLD ***//
-    mat4 ray_global = ray_model.getGlobalMatrix(all_transforms);
-    
-    //translate the center of ray locally before applying global positionthen get position
-    ray_global.translateLocal(ray.local_center.x, ray.local_center.y, ray.local_center.z);
-    vec3 p = ray_global.position();
-    
-    //direction is more complex as we must rotate the it without translation or scale
-    //To do this we muts multiply the direction by the InverseTranspose of the global model
-    //setting translation component to zero first. This is similar to the normal matrix in a shader
-    mat4 inv = ray_global;
-    inv.m[12] = 0.0; inv.m[13] = 0.0; inv.m[14] = 0.0;
-    inv.inverse();
-    mat4 inv_trans = inv.transpose();
-    vec3 q = inv_trans * ray.direction.normalize(); //normalize direction as there's no guarantee it's length = 1!
-    
-    //now scale q by max distance to get segment size - safe to do this as direction was normalized
+    // - get segment in world space, and box in its own local space (both cached per frame)
+    // - transform segment into box space, where the box is axis aligned
+    // - clip segment against the three slabs of the box
+    // a hit is only reported where the segment enters the box, so a segment starting
+    // inside the box doesn't collide, as when the box was tested as six one-sided quads
+    
+    int box_id = ECS.getComponentID<Collider>(box.owner);
+    ColliderWorldData& ray_world = world_data_[ECS.getComponentID<Collider>(ray.owner)];
+    vec3 p = ray_world.origin;
+    
+    //now scale direction by max distance to get segment size
     float test_distance = (ray.max_distance < max_distance ? ray.max_distance : max_distance);
-    q = q * test_distance;
+    vec3 pq = ray_world.ray_direction * test_distance;
     
-    //so far q was DIRECTION (length = ray.max_distance), now make it POINT from p
-    q = p + q;
+    float t;
+    if (!intersectSegmentBoxSlab_(p, pq, box_id, t))
+        return false;
     
-    //now do tests
-    //quads are:
-    //abcd; dcgh, hgfe, efba, adhe, bfgc
-    bool abcd = intersectSegmentQuad(p, q, a, b, c, d, col_point);
-    if (abcd) {
-        col_distance = (ray_global.position()-col_point).length();
-        return true;
+    col_point = p + pq * t;
+    col_distance = (p - col_point).length();
+    return true;
+}
+
+// Slab test of segment p -> p + pq against box collider box_id, in the box's local
+// space. Returns true if the segment enters the box, and the segment parameter t
+// (0 to 1) of the entry point
+bool CollisionSystem::intersectSegmentBoxSlab_(const vec3& p, const vec3& pq, int box_id, float& t) {
+    float t_near = 0.0f;
+    float t_far = 1.0f;
+    for (int k = 0; k < 3; k++) {
+        //row k of the world to box matrix. Transforms are affine so t is the same in both spaces
+        float r0 = box_soa_.to_local[k][box_id];
+        float r1 = box_soa_.to_local[3 + k][box_id];
+        float r2 = box_soa_.to_local[6 + k][box_id];
+        float r3 = box_soa_.to_local[9 + k][box_id];
+        float lp = r0 * p.x + r1 * p.y + r2 * p.z + r3;
+        float ld = r0 * pq.x + r1 * pq.y + r2 * pq.z;
+        float inv = 1.0f / ld;
+        float t1 = (box_soa_.min[k][box_id] - lp) * inv;
+        float t2 = (box_soa_.max[k][box_id] - lp) * inv;
+        float t_enter = t1 < t2 ? t1 : t2;
+        float t_exit = t1 < t2 ? t2 : t1;
+        if (k == 0 || t_enter > t_near) t_near = t_enter;
+        if (t_exit < t_far) t_far = t_exit;
     }
-    bool dcgh = intersectSegmentQuad(p, q, d, c, g, h, col_point);
-    if (dcgh) {
-        col_distance = (ray_global.position()-col_point).length();
-        return true;
+    t = t_near;
+    //entry must be in front of start, on the segment, and before exit
+    return t_near >= 0.0f && t_near <= t_far;
+}
+
+#ifdef COLLISION_SSE
+// Tests segment p -> p + pq against four box colliders at once, one per lane.
+// Same maths as intersectSegmentBoxSlab_. Returns a bit mask of the lanes which
+// hit, with entry parameters in t_out
+int CollisionSystem::intersectSegmentBoxes4_(const vec3& p, const vec3& pq, const int* boxes, float* t_out) {
+    const int b0 = boxes[0], b1 = boxes[1], b2 = boxes[2], b3 = boxes[3];
+    //boxes come from the tree in any order, so each lane is gathered from the SoA arrays
+#define GATHER(arr) _mm_set_ps((arr)[b3], (arr)[b2], (arr)[b1], (arr)[b0])
+    __m128 px = _mm_set1_ps(p.x), py = _mm_set1_ps(p.y), pz = _mm_set1_ps(p.z);
+    __m128 dx = _mm_set1_ps(pq.x), dy = _mm_set1_ps(pq.y), dz = _mm_set1_ps(pq.z);
+    __m128 t_near = _mm_setzero_ps();
+    __m128 t_far = _mm_set1_ps(1.0f);
+    for (int k = 0; k < 3; k++) {
+        __m128 r0 = GATHER(box_soa_.to_local[k]);
+        __m128 r1 = GATHER(box_soa_.to_local[3 + k]);
+        __m128 r2 = GATHER(box_soa_.to_local[6 + k]);
+        __m128 r3 = GATHER(box_soa_.to_local[9 + k]);
+        __m128 lp = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r0, px), _mm_mul_ps(r1, py)), _mm_add_ps(_mm_mul_ps(r2, pz), r3));
+        __m128 ld = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r0, dx), _mm_mul_ps(r1, dy)), _mm_mul_ps(r2, dz));
+        __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), ld);
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(GATHER(box_soa_.min[k]), lp), inv);
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(GATHER(box_soa_.max[k]), lp), inv);
+        __m128 t_enter = _mm_min_ps(t1, t2);
+        __m128 t_exit = _mm_max_ps(t1, t2);
+        t_near = k == 0 ? t_enter : _mm_max_ps(t_enter, t_near);
+        t_far = _mm_min_ps(t_exit, t_far);
     }
-    bool hgfe = intersectSegmentQuad(p, q, h, g, f, e, col_point);
-    if (hgfe) {
-        col_distance = (ray_global.position()-col_point).length();
-        return true;
+#undef GATHER
+    __m128 hit = _mm_and_ps(_mm_cmpge_ps(t_near, _mm_setzero_ps()), _mm_cmple_ps(t_near, t_far));
+    _mm_storeu_ps(t_out, t_near);
+    return _mm_movemask_ps(hit);
+}
+#else
+// Scalar version of the four box kernel
+int CollisionSystem::intersectSegmentBoxes4_(const vec3& p, const vec3& pq, const int* boxes, float* t_out) {
+    int mask = 0;
+    for (int lane = 0; lane < 4; lane++)
+        if (intersectSegmentBoxSlab_(p, pq, boxes[lane], t_out[lane])) mask |= 1 << lane;
+    return mask;
+}
+#endif
+
+// Segment p -> p + pq against sphere collider sphere_id. As with boxes, only
+// a segment entering the sphere hits it. See page 178 of Real Time Collision Detection
+bool CollisionSystem::intersectSegmentSphere_(const vec3& p, const vec3& pq, int sphere_id, float& t) {
+    const ColliderWorldData& sphere = world_data_[sphere_id];
+    vec3 m = p - sphere.center;
+    float a = pq.dot(pq);
+    float b = m.dot(pq);
+    float c = m.dot(m) - sphere.radius * sphere.radius;
+    //starting inside sphere, or zero length segment
+    if (c < 0.0f || a <= 0.0f) return false;
+    float discr = b * b - a * c;
+    if (discr < 0.0f) return false;
+    t = (-b - sqrtf(discr)) / a;
+    return t >= 0.0f && t <= 1.0f;
+}
+
+// Segment p -> p + pq against mesh collider mesh_id. The segment is moved into the
+// mesh's local space, where its BVH was built, and each triangle in the leaves it
+// reaches is tested with intersectSegmentTriangle
+bool CollisionSystem::intersectSegmentMesh_(const vec3& p, const vec3& pq, int mesh_id, float& t) {
+    const MeshBVH& bvh = mesh_bvhs_[world_data_[mesh_id].mesh_bvh];
+    float lp[3], lpq[3];
+    for (int k = 0; k < 3; k++) {
+        float r0 = box_soa_.to_local[k][mesh_id];
+        float r1 = box_soa_.to_local[3 + k][mesh_id];
+        float r2 = box_soa_.to_local[6 + k][mesh_id];
+        float r3 = box_soa_.to_local[9 + k][mesh_id];
+        lp[k] = r0 * p.x + r1 * p.y + r2 * p.z + r3;
+        lpq[k] = r0 * pq.x + r1 * pq.y + r2 * pq.z;
     }
-    bool efba = intersectSegmentQuad(p, q, e, f, b, a, col_point);
-    if (efba) {
-        col_distance = (ray_global.position()-col_point).length();
-        return true;
+    vec3 local_p(lp[0], lp[1], lp[2]);
+    vec3 local_pq(lpq[0], lpq[1], lpq[2]);
+    vec3 local_q = local_p + local_pq;
+    
+    bool hit = false;
+    bvh.raycast(local_p, local_pq, 1.0f, [&](int triangle, float max_t) {
+        const vec3* v = bvh.getTriangle(triangle);
+        float tri_t;
+        if (intersectSegmentTriangle(local_p, local_q, v[0], v[1], v[2], tri_t) && tri_t < max_t) {
+            hit = true;
+            t = tri_t;
+            return tri_t;
+        }
+        return max_t;
+    });
+    return hit;
+}
+
+// Gets BVH for a mesh from an OBJ file. If its cache file was saved from the
+// same OBJ data, it's loaded from there, otherwise it's built and saved there.
+// A cache which can't be saved only costs a rebuild on the next load
+int CollisionSystem::loadMeshBVH(const std::string& filename) {
+    //hash file contents, so a cached BVH of an edited OBJ isn't used
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        std::cerr << "ERROR: Could not open mesh file for collider" << std::endl;
+        return -1;
     }
-    bool adhe = intersectSegmentQuad(p, q, a, d, h, e, col_point);
-    if (adhe) {
-        col_distance = (ray_global.position()-col_point).length();
-        return true;
+    unsigned long long hash = 14695981039346656037ULL; //FNV-1a
+    char buffer[4096];
+    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
+        std::streamsize n = file.gcount();
+        for (std::streamsize i = 0; i < n; i++) {
+            hash ^= (unsigned char)buffer[i];
+            hash *= 1099511628211ULL;
+        }
     }
-    bool bfgc = intersectSegmentQuad(p, q, b, f, g, c, col_point);
-    if (bfgc) {
-        col_distance = (ray_global.position()-col_point).length();
-        return true;
+    
+    MeshBVH bvh;
+    std::string bvh_filename = filename + ".bvh";
+    if (!bvh_cache_directory_.empty()) {
+        size_t slash = filename.find_last_of("/\\");
+        bvh_filename = bvh_cache_directory_ + (slash == std::string::npos ? filename : filename.substr(slash + 1)) + ".bvh";
+    }
+    if (!bvh.load(bvh_filename, hash)) {
+        std::vector<float> vertices, uvs, normals;
+        std::vector<unsigned int> indices;
+        if (!Parsers::parseOBJ(filename, vertices, uvs, normals, indices)) {
+            std::cerr << "ERROR: Could not parse mesh file for collider" << std::endl;
+            return -1;
+        }
+        bvh.build(vertices, indices);
+        if (!bvh.save(bvh_filename, hash))
+            std::cerr << "ERROR: Could not save mesh BVH cache: " << bvh_filename << std::endl;
+    }
+    mesh_bvhs_.push_back(bvh);
+    return (int)mesh_bvhs_.size() - 1;
+}
+
+// Builds BVH from vertex positions and triangle indices already in memory
+int CollisionSystem::addMeshBVH(const std::vector<float>& vertices, const std::vector<unsigned int>& indices) {
+    mesh_bvhs_.emplace_back();
+    mesh_bvhs_.back().build(vertices, indices);
+    return (int)mesh_bvhs_.size() - 1;
+}
+
+static bool sameVec3(const vec3& a, const vec3& b) {
+    return a.x == b.x && a.y == b.y && a.z == b.z;
+}
+
+// Recalculates the world space box corners and ray start and direction of each
+// collider whose transform moved or whose local shape was edited since last frame
+void CollisionSystem::updateColliderWorldData_() {
+    //colliders were removed, so remove their boxes from the tree
+    size_t num_colliders = ECS.getAllComponents<Collider>().size();
+    for (size_t i = num_colliders; i < world_data_.size(); i++) {
+        if (world_data_[i].proxy != -1) shape_tree_.remove(world_data_[i].proxy);
+    }
+    world_data_.resize(num_colliders);
+    for (int k = 0; k < 12; k++) box_soa_.to_local[k].resize(num_colliders);
+    for (int k = 0; k < 3; k++) {
+        box_soa_.min[k].resize(num_colliders);
+        box_soa_.max[k].resize(num_colliders);
     }
     
-    //no collision! return false
-    return false;
+    ECS.view<Collider, Transform>().each([this](Collider& col, Transform& transform) {
+        ColliderWorldData& wd = world_data_[ECS.getComponentIndex(col)];
+        int transform_id = ECS.getComponentIndex(transform);
+        if (wd.transform == transform_id &&
+            wd.collider_type == col.collider_type &&
+            wd.world_version == ECS.world_versions[transform_id] &&
+            sameVec3(wd.local_center, col.local_center) &&
+            sameVec3(wd.local_halfwidth, col.local_halfwidth) &&
+            sameVec3(wd.direction, col.direction) &&
+            wd.local_radius == col.radius &&
+            wd.mesh_bvh == col.mesh_bvh)
+            return;
+        
+        wd.transform = transform_id;
+        wd.collider_type = col.collider_type;
+        wd.world_version = ECS.world_versions[transform_id];
+        wd.local_center = col.local_center;
+        wd.local_halfwidth = col.local_halfwidth;
+        wd.direction = col.direction;
+        wd.local_radius = col.radius;
+        wd.mesh_bvh = col.mesh_bvh;
+        wd.revision = next_revision_++;
+        
+        const mat4& global = ECS.getWorldMatrix(transform_id);
+        
+        //*** TRANSFORM BOX TO WORLD ***//
+        //get each corner of box in local space
+        float x = col.local_halfwidth.x;
+        float y = col.local_halfwidth.y;
+        float z = col.local_halfwidth.z;
+        vec3 off = col.local_center;
+        vec3 local_corners[8] = {
+            vec3( -x,   y,  z), vec3( -x,  -y,  z), vec3(  x,  -y,  z), vec3(  x,   y,  z),
+            vec3( -x,   y, -z), vec3( -x,  -y, -z), vec3(  x,  -y, -z), vec3(  x,   y, -z) };
+        
+        //move center and multiply by model matrix
+        for (int k = 0; k < 8; k++)
+            wd.corners[k] = global * (local_corners[k] + off);
+        
+        //*** TRANSFORM RAY TO WORLD ***//
+        //translate the center of ray locally before applying global position then get position
+        mat4 ray_global = global;
+        ray_global.translateLocal(col.local_center.x, col.local_center.y, col.local_center.z);
+        wd.origin = ray_global.position();
+        
+        //direction is more complex as we must rotate the it without translation or scale
+        //To do this we multiply the direction by the InverseTranspose of the global model
+        //without translation. This is the normal matrix used in a shader
+        vec3 dir = col.direction;
+        wd.ray_direction = ray_global.normalMatrix() * dir.normalize(); //normalize direction as there's no guarantee it's length = 1!
+        
+        //*** BOX IN LOCAL SPACE ***//
+        //store the world to local matrix, and the axis aligned box in that space,
+        //for the slab tests. Rows are stored as columns of the SoA arrays
+        int collider_id = ECS.getComponentIndex(col);
+        mat4 to_local = global;
+        bool invertible = to_local.affineInverse();
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 4; c++)
+                box_soa_.to_local[c * 3 + r][collider_id] = to_local.m[c * 4 + r];
+        float box_local_min[3] = { off.x - x, off.y - y, off.z - z };
+        float box_local_max[3] = { off.x + x, off.y + y, off.z + z };
+        for (int k = 0; k < 3; k++) {
+            //degenerate boxes have min > max, so no segment can hit them
+            box_soa_.min[k][collider_id] = invertible ? std::min(box_local_min[k], box_local_max[k]) : 1.0f;
+            box_soa_.max[k][collider_id] = invertible ? std::max(box_local_min[k], box_local_max[k]) : -1.0f;
+        }
+        
+        //*** ORIENTED BOX AND SPHERE IN WORLD ***//
+        //axes are the columns of the world matrix, whose lengths scale the box.
+        //Spheres are scaled by the largest axis scale
+        wd.center = global * off;
+        float scale[3];
+        for (int k = 0; k < 3; k++) {
+            vec3 axis(global.m[k * 4], global.m[k * 4 + 1], global.m[k * 4 + 2]);
+            scale[k] = axis.length();
+            wd.axes[k] = scale[k] > 0.0f ? axis * (1.0f / scale[k]) : vec3(k == 0 ? 1.0f : 0.0f, k == 1 ? 1.0f : 0.0f, k == 2 ? 1.0f : 0.0f);
+        }
+        wd.extents = vec3(fabs(x) * scale[0], fabs(y) * scale[1], fabs(z) * scale[2]);
+        wd.radius = col.radius * std::max(scale[0], std::max(scale[1], scale[2]));
+        
+        //*** UPDATE BROADPHASE ***//
+        //the tree only needs refitting when the shape leaves its fattened leaf
+        bool is_mesh = col.collider_type == ColliderTypeMesh && col.mesh_bvh >= 0 && col.mesh_bvh < (int)mesh_bvhs_.size();
+        if (col.collider_type == ColliderTypeBox || col.collider_type == ColliderTypeSphere || is_mesh) {
+            if (is_mesh) {
+                //transform corners of the BVH bounds, which are in the mesh's local space
+                const vec3& mn = mesh_bvhs_[col.mesh_bvh].getMin();
+                const vec3& mx = mesh_bvhs_[col.mesh_bvh].getMax();
+                wd.aabb_min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+                wd.aabb_max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+                for (int k = 0; k < 8; k++) {
+                    vec3 c = global * vec3(k & 1 ? mx.x : mn.x, k & 2 ? mx.y : mn.y, k & 4 ? mx.z : mn.z);
+                    wd.aabb_min = vec3(std::min(wd.aabb_min.x, c.x), std::min(wd.aabb_min.y, c.y), std::min(wd.aabb_min.z, c.z));
+                    wd.aabb_max = vec3(std::max(wd.aabb_max.x, c.x), std::max(wd.aabb_max.y, c.y), std::max(wd.aabb_max.z, c.z));
+                }
+            }
+            else if (col.collider_type == ColliderTypeBox) {
+                wd.aabb_min = wd.corners[0];
+                wd.aabb_max = wd.corners[0];
+                for (int k = 1; k < 8; k++) {
+                    const vec3& c = wd.corners[k];
+                    if (c.x < wd.aabb_min.x) wd.aabb_min.x = c.x;
+                    if (c.y < wd.aabb_min.y) wd.aabb_min.y = c.y;
+                    if (c.z < wd.aabb_min.z) wd.aabb_min.z = c.z;
+                    if (c.x > wd.aabb_max.x) wd.aabb_max.x = c.x;
+                    if (c.y > wd.aabb_max.y) wd.aabb_max.y = c.y;
+                    if (c.z > wd.aabb_max.z) wd.aabb_max.z = c.z;
+                }
+            }
+            else {
+                vec3 r(wd.radius, wd.radius, wd.radius);
+                wd.aabb_min = wd.center - r;
+                wd.aabb_max = wd.center + r;
+            }
+            if (wd.proxy == -1)
+                wd.proxy = shape_tree_.insert(wd.aabb_min, wd.aabb_max, collider_id);
+            else
+                shape_tree_.move(wd.proxy, wd.aabb_min, wd.aabb_max);
+        }
+        else if (wd.proxy != -1) {
+            shape_tree_.remove(wd.proxy);
+            wd.proxy = -1;
+        }
+    });
 }
 
 // Test for collision between a segment PQ and a directed, plane quad (ABDC)
@@ -229,6 +550,12 @@ bool CollisionSystem::intersectSegmentQuad(lm::vec3 p, lm::vec3 q, lm::vec3 a, l
 
 //See page 190 of Real Time Collision Detection
 bool CollisionSystem::intersectSegmentTriangle(lm::vec3 p, lm::vec3 q, lm::vec3 a, lm::vec3 b, lm::vec3 c) {
+    float t;
+    return intersectSegmentTriangle(p, q, a, b, c, t);
+}
+
+//as above, also returning segment parameter t (0 to 1) of the intersection
+bool CollisionSystem::intersectSegmentTriangle(lm::vec3 p, lm::vec3 q, lm::vec3 a, lm::vec3 b, lm::vec3 c, float& t_out) {
     vec3 ab = b - a;
     vec3 ac = c - a;
     vec3 qp = p - q;
@@ -252,6 +579,7 @@ bool CollisionSystem::intersectSegmentTriangle(lm::vec3 p, lm::vec3 q, lm::vec3
     float w = -(ab.dot(e));
     if (w < 0.0f || v + w > d) return false;
     
+    t_out = t / d;
     return true;
 }
 
@@ -291,3 +619,355 @@ bool CollisionSystem::intersectLineQuad(lm::vec3 p, lm::vec3 q, lm::vec3 a, lm::
     return true;
 }
 
+static unsigned long long pairKey(int a, int b) {
+    return ((unsigned long long)(unsigned int)a << 32) | (unsigned int)b;
+}
+
+// Finds overlapping box and sphere colliders with the shape tree, and generates
+// contacts for them. Pairs whose colliders haven't moved since the previous frame
+// reuse their cached contact, so resting objects cost one lookup per pair
+void CollisionSystem::updateContacts_() {
+    frame_++;
+    auto& colliders = ECS.getAllComponents<Collider>();
+    
+    //broadphase - each shape queries the tree with its world bounds
+    pairs_.clear();
+    for (size_t i = 0; i < world_data_.size(); i++) {
+        const ColliderWorldData& wd = world_data_[i];
+        if (wd.proxy == -1 || wd.collider_type == ColliderTypeMesh) continue;
+        shape_tree_.query(wd.aabb_min, wd.aabb_max, [&](int j) {
+            if (j <= (int)i) return; //each pair once
+            if (world_data_[j].collider_type == ColliderTypeMesh) return; //meshes only take rays
+            //tree leaves are fattened, so check the tight bounds too
+            const ColliderWorldData& other = world_data_[j];
+            if (other.aabb_max.x < wd.aabb_min.x || other.aabb_min.x > wd.aabb_max.x ||
+                other.aabb_max.y < wd.aabb_min.y || other.aabb_min.y > wd.aabb_max.y ||
+                other.aabb_max.z < wd.aabb_min.z || other.aabb_min.z > wd.aabb_max.z)
+                return;
+            PairResult pair;
+            pair.a = (int)i;
+            pair.b = j;
+            pair.cached = false;
+            pair.touching = false;
+            pairs_.push_back(pair);
+        });
+    }
+    
+    //narrowphase - in parallel, as the cache is only read here
+    JOBS.parallelFor(pairs_, PAIR_CHUNK, [this](PairResult& pair, size_t) {
+        const ColliderWorldData& a = world_data_[pair.a];
+        const ColliderWorldData& b = world_data_[pair.b];
+        auto it = pair_cache_.find(pairKey(pair.a, pair.b));
+        if (it != pair_cache_.end() && it->second.revision_a == a.revision && it->second.revision_b == b.revision) {
+            pair.cached = true;
+            pair.touching = it->second.touching;
+            pair.contact = it->second.contact;
+            return;
+        }
+        
+        pair.contact = Contact();
+        pair.contact.a = pair.a;
+        pair.contact.b = pair.b;
+        bool sphere_a = a.collider_type == ColliderTypeSphere;
+        bool sphere_b = b.collider_type == ColliderTypeSphere;
+        if (sphere_a && sphere_b)
+            pair.touching = collideSpheres_(a, b, pair.contact);
+        else if (sphere_a)
+            pair.touching = collideSphereBox_(a, b, pair.contact);
+        else if (sphere_b) {
+            //normal was found from sphere to box, but must point from a to b
+            pair.touching = collideSphereBox_(b, a, pair.contact);
+            pair.contact.normal = pair.contact.normal * -1.0f;
+        }
+        else
+            pair.touching = collideBoxes_(a, b, pair.contact);
+    });
+    
+    //store results in the cache and apply them to the colliders, in broadphase order
+    contacts_.clear();
+    for (auto& pair : pairs_) {
+        CachedPair& cached = pair_cache_[pairKey(pair.a, pair.b)];
+        cached.frame = frame_;
+        if (!pair.cached) {
+            cached.revision_a = world_data_[pair.a].revision;
+            cached.revision_b = world_data_[pair.b].revision;
+            cached.touching = pair.touching;
+            cached.contact = pair.contact;
+        }
+        if (!pair.touching) continue;
+        
+        contacts_.push_back(pair.contact);
+        Collider& col_a = colliders[pair.a];
+        Collider& col_b = colliders[pair.b];
+        col_a.colliding = col_b.colliding = true;
+        col_a.other = col_b.owner; col_b.other = col_a.owner;
+        col_a.collision_point = col_b.collision_point = pair.contact.points[0];
+    }
+    
+    //forget pairs which are no longer overlapping in the broadphase
+    for (auto it = pair_cache_.begin(); it != pair_cache_.end();) {
+        if (it->second.frame != frame_) it = pair_cache_.erase(it);
+        else ++it;
+    }
+}
+
+// Sphere vs sphere, with a single contact point halfway through the overlap
+bool CollisionSystem::collideSpheres_(const ColliderWorldData& a, const ColliderWorldData& b, Contact& contact) {
+    vec3 d = b.center - a.center;
+    float dist2 = d.dot(d);
+    float r = a.radius + b.radius;
+    if (dist2 > r * r) return false;
+    
+    float dist = sqrtf(dist2);
+    //concentric spheres can be pushed apart in any direction
+    contact.normal = dist > 0.0001f ? d * (1.0f / dist) : vec3(0.0f, 1.0f, 0.0f);
+    contact.depth = r - dist;
+    contact.num_points = 1;
+    contact.points[0] = a.center + contact.normal * (a.radius - contact.depth * 0.5f);
+    return true;
+}
+
+// Sphere vs oriented box, using the closest point of the box to the sphere center.
+// Normal points from sphere to box. See page 132 of Real Time Collision Detection
+bool CollisionSystem::collideSphereBox_(const ColliderWorldData& sphere, const ColliderWorldData& box, Contact& contact) {
+    vec3 d = sphere.center - box.center;
+    vec3 closest = box.center;
+    float local[3];
+    bool inside = true;
+    for (int k = 0; k < 3; k++) {
+        float e = box.extents.value_[k];
+        float dist = d.dot(box.axes[k]);
+        local[k] = dist;
+        if (dist > e) { dist = e; inside = false; }
+        if (dist < -e) { dist = -e; inside = false; }
+        closest = closest + box.axes[k] * dist;
+    }
+    
+    contact.num_points = 1;
+    if (!inside) {
+        vec3 v = sphere.center - closest;
+        float dist2 = v.dot(v);
+        if (dist2 > sphere.radius * sphere.radius) return false;
+        float dist = sqrtf(dist2);
+        if (dist > 0.0001f) contact.normal = v * (-1.0f / dist);
+        else {
+            //center is on the surface, so push it towards the box center, or
+            //out of the face it is furthest past if it is at the center
+            vec3 to_center = box.center - sphere.center;
+            float center_dist = to_center.length();
+            if (center_dist > 0.0001f) contact.normal = to_center * (1.0f / center_dist);
+            else {
+                int face = 0;
+                for (int k = 1; k < 3; k++)
+                    if (fabs(local[k]) - box.extents.value_[k] > fabs(local[face]) - box.extents.value_[face]) face = k;
+                contact.normal = box.axes[face] * (local[face] < 0.0f ? 1.0f : -1.0f);
+            }
+        }
+        contact.depth = sphere.radius - dist;
+        contact.points[0] = closest;
+        return true;
+    }
+    
+    //center is inside the box, so push it out through the nearest face
+    int face = 0;
+    float min_gap = box.extents.value_[0] - fabs(local[0]);
+    for (int k = 1; k < 3; k++) {
+        float gap = box.extents.value_[k] - fabs(local[k]);
+        if (gap < min_gap) { min_gap = gap; face = k; }
+    }
+    vec3 face_normal = box.axes[face] * (local[face] < 0.0f ? -1.0f : 1.0f);
+    contact.normal = face_normal * -1.0f;
+    contact.depth = sphere.radius + min_gap;
+    contact.points[0] = sphere.center + face_normal * min_gap;
+    return true;
+}
+
+// Oriented box vs oriented box with the separating axis test over the 15 axes
+// (3 face normals of each box, and 9 edge cross products). The axis with least
+// overlap gives the normal. Face contacts clip the incident face against the
+// reference face, edge contacts use the closest points of the two edges.
+// See pages 101 - 105 of Real Time Collision Detection
+bool CollisionSystem::collideBoxes_(const ColliderWorldData& a, const ColliderWorldData& b, Contact& contact) {
+    const float EPSILON = 0.000001f;
+    const float* ea = a.extents.value_;
+    const float* eb = b.extents.value_;
+    
+    //rotation of b in a's frame. Epsilon stops parallel edges giving a zero cross product
+    float R[3][3], AbsR[3][3];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++) {
+            R[i][j] = a.axes[i].dot(b.axes[j]);
+            AbsR[i][j] = fabs(R[i][j]) + EPSILON;
+        }
+    //translation in a's frame
+    vec3 tw = b.center - a.center;
+    float t[3] = { tw.dot(a.axes[0]), tw.dot(a.axes[1]), tw.dot(a.axes[2]) };
+    
+    float best = FLT_MAX;
+    int best_type = -1; //0 face of a, 1 face of b, 2 edges
+    int best_i = 0, best_j = 0;
+    vec3 best_normal;
+    
+    //faces of a
+    for (int i = 0; i < 3; i++) {
+        float rb = eb[0] * AbsR[i][0] + eb[1] * AbsR[i][1] + eb[2] * AbsR[i][2];
+        float overlap = ea[i] + rb - fabs(t[i]);
+        if (overlap < 0.0f) return false;
+        if (overlap < best) {
+            best = overlap; best_type = 0; best_i = i;
+            best_normal = a.axes[i] * (t[i] < 0.0f ? -1.0f : 1.0f);
+        }
+    }
+    //faces of b. Slightly prefer faces of a, so the choice doesn't flicker
+    for (int j = 0; j < 3; j++) {
+        float ra = ea[0] * AbsR[0][j] + ea[1] * AbsR[1][j] + ea[2] * AbsR[2][j];
+        float dist = t[0] * R[0][j] + t[1] * R[1][j] + t[2] * R[2][j];
+        float overlap = ra + eb[j] - fabs(dist);
+        if (overlap < 0.0f) return false;
+        if (overlap < best * 0.98f) {
+            best = overlap; best_type = 1; best_j = j;
+            best_normal = b.axes[j] * (dist < 0.0f ? -1.0f : 1.0f);
+        }
+    }
+    //edge pairs. Only chosen when clearly better than a face, as face contacts are more stable
+    for (int i = 0; i < 3; i++) {
+        int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+        for (int j = 0; j < 3; j++) {
+            int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            float ra = ea[i1] * AbsR[i2][j] + ea[i2] * AbsR[i1][j];
+            float rb = eb[j1] * AbsR[i][j2] + eb[j2] * AbsR[i][j1];
+            float dist = t[i2] * R[i1][j] - t[i1] * R[i2][j];
+            float overlap = ra + rb - fabs(dist);
+            if (overlap < 0.0f) return false;
+            //parallel edges are covered by the face axes
+            vec3 axis = a.axes[i].cross(b.axes[j]);
+            float len = axis.length();
+            if (len < 0.001f) continue;
+            overlap /= len;
+            if (overlap < best * 0.95f - 0.001f) {
+                best = overlap; best_type = 2; best_i = i; best_j = j;
+                best_normal = axis * ((dist < 0.0f ? -1.0f : 1.0f) / len);
+            }
+        }
+    }
+    
+    contact.normal = best_normal;
+    contact.depth = best;
+    if (best_type == 0) {
+        clipBoxFaces_(a, best_i, best_normal, b, contact);
+    }
+    else if (best_type == 1) {
+        //reference face of b faces a
+        clipBoxFaces_(b, best_j, best_normal * -1.0f, a, contact);
+    }
+    else {
+        //the edge of each box which lies furthest towards the other box
+        vec3 pa = a.center;
+        vec3 pb = b.center;
+        for (int k = 0; k < 3; k++) {
+            if (k != best_i)
+                pa = pa + a.axes[k] * (best_normal.dot(a.axes[k]) < 0.0f ? -ea[k] : ea[k]);
+            if (k != best_j)
+                pb = pb + b.axes[k] * (best_normal.dot(b.axes[k]) < 0.0f ? eb[k] : -eb[k]);
+        }
+        //closest points of the two edge lines, clamped to the edges
+        const vec3& da = a.axes[best_i];
+        const vec3& db = b.axes[best_j];
+        vec3 r = pa - pb;
+        float dadb = da.dot(db);
+        float c = da.dot(r);
+        float f = db.dot(r);
+        float denom = 1.0f - dadb * dadb;
+        float sa = denom > EPSILON ? (dadb * f - c) / denom : 0.0f;
+        sa = std::max(-ea[best_i], std::min(ea[best_i], sa));
+        float sb = dadb * sa + f;
+        sb = std::max(-eb[best_j], std::min(eb[best_j], sb));
+        contact.num_points = 1;
+        contact.points[0] = (pa + da * sa + pb + db * sb) * 0.5f;
+    }
+    return true;
+}
+
+// Clips the face of box inc which most opposes ref_normal against the face of box ref
+// along ref_axis, which faces the other box. Incident points behind the reference
+// face are contact points. More than four are reduced to the extremes along each
+// axis of the reference face
+void CollisionSystem::clipBoxFaces_(const ColliderWorldData& ref, int ref_axis, const vec3& ref_normal, const ColliderWorldData& inc, Contact& contact) {
+    const int MAX_POLY = 16;
+    
+    //incident face
+    int inc_axis = 0;
+    float inc_dot = 0.0f;
+    for (int k = 0; k < 3; k++) {
+        float dot = inc.axes[k].dot(ref_normal);
+        if (fabs(dot) > fabs(inc_dot)) { inc_dot = dot; inc_axis = k; }
+    }
+    vec3 inc_normal = inc.axes[inc_axis] * (inc_dot > 0.0f ? -1.0f : 1.0f);
+    vec3 inc_center = inc.center + inc_normal * inc.extents.value_[inc_axis];
+    vec3 u = inc.axes[(inc_axis + 1) % 3] * inc.extents.value_[(inc_axis + 1) % 3];
+    vec3 v = inc.axes[(inc_axis + 2) % 3] * inc.extents.value_[(inc_axis + 2) % 3];
+    vec3 poly[MAX_POLY] = { inc_center + u + v, inc_center - u + v, inc_center - u - v, inc_center + u - v };
+    int poly_size = 4;
+    
+    //clip against the four side planes of the reference face
+    int side_axes[2] = { (ref_axis + 1) % 3, (ref_axis + 2) % 3 };
+    for (int s = 0; s < 4 && poly_size > 0; s++) {
+        int axis = side_axes[s / 2];
+        float sign = (s % 2) ? -1.0f : 1.0f;
+        vec3 plane_normal = ref.axes[axis] * sign;
+        float plane_offset = plane_normal.dot(ref.center) + ref.extents.value_[axis];
+        
+        vec3 clipped[MAX_POLY];
+        int clipped_size = 0;
+        for (int k = 0; k < poly_size; k++) {
+            const vec3& p0 = poly[k];
+            const vec3& p1 = poly[(k + 1) % poly_size];
+            float d0 = plane_normal.dot(p0) - plane_offset;
+            float d1 = plane_normal.dot(p1) - plane_offset;
+            if (d0 <= 0.0f && clipped_size < MAX_POLY) clipped[clipped_size++] = p0;
+            if ((d0 < 0.0f && d1 > 0.0f) || (d0 > 0.0f && d1 < 0.0f)) {
+                if (clipped_size < MAX_POLY) clipped[clipped_size++] = p0 + (p1 - p0) * (d0 / (d0 - d1));
+            }
+        }
+        for (int k = 0; k < clipped_size; k++) poly[k] = clipped[k];
+        poly_size = clipped_size;
+    }
+    
+    //keep points behind the reference face
+    vec3 ref_center = ref.center + ref_normal * ref.extents.value_[ref_axis];
+    vec3 points[MAX_POLY];
+    int num_points = 0;
+    for (int k = 0; k < poly_size; k++)
+        if ((poly[k] - ref_center).dot(ref_normal) <= 0.0f) points[num_points++] = poly[k];
+    
+    //numerical corner cases can clip everything away. Use the deepest incident corner
+    if (num_points == 0) {
+        vec3 corners[4] = { inc_center + u + v, inc_center - u + v, inc_center - u - v, inc_center + u - v };
+        points[0] = corners[0];
+        for (int k = 1; k < 4; k++)
+            if (corners[k].dot(ref_normal) < points[0].dot(ref_normal)) points[0] = corners[k];
+        num_points = 1;
+    }
+    
+    if (num_points <= 4) {
+        for (int k = 0; k < num_points; k++) contact.points[k] = points[k];
+        contact.num_points = num_points;
+        return;
+    }
+    
+    //reduce to the points furthest along each side axis of the reference face
+    int extremes[4] = { 0, 0, 0, 0 };
+    for (int k = 1; k < num_points; k++) {
+        for (int e = 0; e < 2; e++) {
+            float d = points[k].dot(ref.axes[side_axes[e]]);
+            if (d > points[extremes[e * 2]].dot(ref.axes[side_axes[e]])) extremes[e * 2] = k;
+            if (d < points[extremes[e * 2 + 1]].dot(ref.axes[side_axes[e]])) extremes[e * 2 + 1] = k;
+        }
+    }
+    contact.num_points = 0;
+    for (int e = 0; e < 4; e++) {
+        bool duplicate = false;
+        for (int k = 0; k < e; k++) duplicate = duplicate || extremes[k] == extremes[e];
+        if (!duplicate) contact.points[contact.num_points++] = points[extremes[e]];
+    }
+}
@@ -1,17 +1,155 @@
 #pragma once
 #include "includes.h"
 #include "Components.h"
+#include "AABBTree.h"
+#include "MeshBVH.h"
+#include <unordered_map>
+
+//4 wide SSE kernel for ray vs box tests, when the target supports it
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define COLLISION_SSE
+#include <xmmintrin.h>
+#endif
 
 class CollisionSystem {
 public:
+    //ray for batched queries, in world space. Direction must be unit length
+    struct Ray {
+        lm::vec3 origin;
+        lm::vec3 direction;
+        float max_distance = 100000.0f;
+    };
+    //nearest box, sphere or mesh collider hit by a ray, if any
+    struct Hit {
+        bool hit = false;
+        int collider = -1; //index in collider array
+        int entity = -1;
+        lm::vec3 point;
+        float distance = 0.0f;
+    };
+    
+    //touching pair of box or sphere colliders. Normal points from a to b
+    struct Contact {
+        int a = -1; //collider indices, a < b
+        int b = -1;
+        lm::vec3 normal;
+        float depth = 0.0f; //penetration along normal
+        int num_points = 0;
+        lm::vec3 points[4];
+    };
+    
     void init();
     void update(float dt);
+    
+    //contacts between box and sphere colliders found in the last update
+    const std::vector<Contact>& getContacts() const { return contacts_; }
+    
+    //traces count rays against the box, sphere and mesh colliders as they were at the last
+    //update, writing the nearest hit of each ray to hits. Doesn't change any
+    //collider, so can be called from any system which runs after collision
+    void raycastBatch(const Ray* rays, Hit* hits, size_t count);
     bool intersectSegmentBox(Collider& ray, Collider& box, lm::vec3& col_point, float& col_distance, float max_distance = 100000.0f);
     
+    //BVHs for mesh colliders, which refer to them by the index returned.
+    //loadMeshBVH caches the built BVH in a .bvh file, see setBVHCacheDirectory
+    int loadMeshBVH(const std::string& filename);
+    int addMeshBVH(const std::vector<float>& vertices, const std::vector<unsigned int>& indices);
+    //directory, ending in '/', where BVH caches are kept as <obj name>.bvh. If
+    //empty (the default) each cache is kept next to its OBJ, as <obj file>.bvh
+    void setBVHCacheDirectory(const std::string& directory) { bvh_cache_directory_ = directory; }
+    
     bool intersectSegmentTriangle(lm::vec3 p, lm::vec3 q, lm::vec3 a, lm::vec3 b, lm::vec3 c);
+    bool intersectSegmentTriangle(lm::vec3 p, lm::vec3 q, lm::vec3 a, lm::vec3 b, lm::vec3 c, float& t);
     bool intersectSegmentQuad(lm::vec3 p, lm::vec3 q, lm::vec3 a, lm::vec3 b, lm::vec3 c, lm::vec3 d, lm::vec3& r);
     
     //LINE not segment
     bool intersectLineQuad(lm::vec3 p, lm::vec3 q, lm::vec3 a, lm::vec3 b, lm::vec3 c, lm::vec3 d, lm::vec3& r);
+
+private:
+    //world space shape of each collider, indexed like the collider array. Only
+    //recalculated when the world matrix of its transform or its local shape changes
+    struct ColliderWorldData {
+        unsigned int world_version = 0;
+        int transform = -1;
+        ColliderType collider_type;
+        unsigned int revision = 0; //changes whenever the data below is recalculated
+        int proxy = -1; //leaf in shape_tree_, for box, sphere and mesh colliders
+        lm::vec3 local_center;
+        lm::vec3 local_halfwidth;
+        lm::vec3 direction;
+        float local_radius = 0.0f;
+        int mesh_bvh = -1;
+        lm::vec3 corners[8]; //box corners, a to h
+        lm::vec3 origin; //ray start point
+        lm::vec3 ray_direction; //unit ray direction
+        lm::vec3 center; //box or sphere center
+        lm::vec3 axes[3]; //unit box axes
+        lm::vec3 extents; //box halfwidth along each axis
+        float radius = 0.0f; //sphere radius
+        lm::vec3 aabb_min; //world bounds of box or sphere
+        lm::vec3 aabb_max;
+    };
+    std::vector<ColliderWorldData> world_data_;
+    unsigned int next_revision_ = 1;
+    
+    //broadphase over world bounds of box, sphere and mesh colliders. Leaf user data is collider index
+    AABBTree shape_tree_;
+    
+    //hits found by each ray, in the order found, before being applied to colliders
+    struct RayHit {
+        int box;
+        lm::vec3 point;
+        float distance;
+    };
+    std::vector<std::vector<RayHit>> ray_hits_;
+    static const size_t RAY_CHUNK = 8;
+    
+    //box of each collider in its own local space, as structure of arrays indexed
+    //like the collider array. to_local holds the top three rows of the world to
+    //local matrix, column by column: [column * 3 + row]
+    struct BoxSoA {
+        std::vector<float> to_local[12];
+        std::vector<float> min[3];
+        std::vector<float> max[3];
+    };
+    BoxSoA box_soa_;
+    
+    std::vector<MeshBVH> mesh_bvhs_;
+    std::string bvh_cache_directory_;
+    
+    //contact of each overlapping pair, kept while the pair overlaps in the broadphase.
+    //If neither collider has moved since, the contact is reused instead of recalculated
+    struct CachedPair {
+        unsigned int revision_a = 0;
+        unsigned int revision_b = 0;
+        unsigned int frame = 0; //last frame the pair was found by the broadphase
+        bool touching = false;
+        Contact contact;
+    };
+    std::unordered_map<unsigned long long, CachedPair> pair_cache_;
+    unsigned int frame_ = 0;
+    std::vector<Contact> contacts_;
+    //pairs found by the broadphase this frame, with their narrowphase results
+    struct PairResult {
+        int a, b;
+        bool cached;
+        bool touching;
+        Contact contact;
+    };
+    std::vector<PairResult> pairs_;
+    static const size_t PAIR_CHUNK = 32;
+    
+    void updateColliderWorldData_();
+    void traceRay_(const lm::vec3& origin, const lm::vec3& direction, float max_distance, float nearest, int self, std::vector<RayHit>& hits);
+    bool intersectSegmentBoxSlab_(const lm::vec3& p, const lm::vec3& pq, int box_id, float& t);
+    int intersectSegmentBoxes4_(const lm::vec3& p, const lm::vec3& pq, const int* boxes, float* t_out);
+    bool intersectSegmentSphere_(const lm::vec3& p, const lm::vec3& pq, int sphere_id, float& t);
+    bool intersectSegmentMesh_(const lm::vec3& p, const lm::vec3& pq, int mesh_id, float& t);
+    
+    void updateContacts_();
+    bool collideSpheres_(const ColliderWorldData& a, const ColliderWorldData& b, Contact& contact);
+    bool collideSphereBox_(const ColliderWorldData& sphere, const ColliderWorldData& box, Contact& contact);
+    bool collideBoxes_(const ColliderWorldData& a, const ColliderWorldData& b, Contact& contact);
+    void clipBoxFaces_(const ColliderWorldData& ref, int ref_axis, const lm::vec3& ref_normal, const ColliderWorldData& inc, Contact& contact);
 };
 
@@ -21,6 +21,13 @@
 
 /**** COMPONENTS ****/
 
+//handle to an entity which remains safe to hold after the entity is destroyed
+//and its slot reused, as the generation will no longer match
+struct EntityHandle {
+    int id = -1;
+    unsigned int generation = 0;
+};
+
 //Component (base class)
 // - owner: id of Entity which owns the instance of the component
 struct Component {
@@ -32,13 +39,59 @@ struct Component {
 // - inherits a mat4 which represents a model matrix
 // - all_transform - reference to vector of all transforms
 struct Transform : public Component, public lm::mat4 {
-    int parent = -1;
-    lm::mat4 getGlobalMatrix(std::vector<Transform>& transforms) {
-        if (parent != - 1){
-            return transforms.at(parent).getGlobalMatrix(transforms) * *this;
-        }
-        else return *this;
-    }
+    //entity whose transform is the parent. Held by entity rather than by
+    //transform id, so moving transforms in their array doesn't touch it. If
+    //the parent entity is destroyed or loses its transform this is a root
+    EntityHandle parent;
+
+    //incremented whenever the local matrix changes. The matrix can only be
+    //modified through the functions below, so derived data is recalculated.
+    //Code which modifies it through an lm::mat4 reference must call markChanged()
+    unsigned int version = 1;
+    void markChanged() { version++; }
+
+    //set when the matrix holds only rotation and translation, so the normal
+    //matrix is just the rotation part. Scaling or setting the matrix clears it,
+    //making an identity, translation or rotation matrix sets it
+    bool rigid = false;
+
+    //mat4 functions which modify the matrix, wrapped to track changes
+    using lm::mat4::position;
+    using lm::mat4::front;
+    void set(lm::mat4 mat) { lm::mat4::set(mat); rigid = false; version++; }
+    void position(float x, float y, float z) { lm::mat4::position(x, y, z); version++; }
+    void position(const lm::vec3& p) { lm::mat4::position(p); version++; }
+    void front(float x, float y, float z) { lm::mat4::front(x, y, z); version++; }
+    void front(lm::vec3 f) { lm::mat4::front(f); version++; }
+    void translate(float x, float y, float z) { lm::mat4::translate(x, y, z); version++; }
+    void translate(const lm::vec3& t) { lm::mat4::translate(t); version++; }
+    void rotate(float angle_in_rad, const lm::vec3& axis) { lm::mat4::rotate(angle_in_rad, axis); version++; }
+    void scale(float x, float y, float z) { lm::mat4::scale(x, y, z); rigid = false; version++; }
+    void scale(const lm::vec3& s) { lm::mat4::scale(s); rigid = false; version++; }
+    void translateLocal(float x, float y, float z) { lm::mat4::translateLocal(x, y, z); version++; }
+    void rotateLocal(float angle_in_rad, const lm::vec3& axis) { lm::mat4::rotateLocal(angle_in_rad, axis); version++; }
+    void scaleLocal(float x, float y, float z) { lm::mat4::scaleLocal(x, y, z); rigid = false; version++; }
+    Transform& setIdentity() { lm::mat4::setIdentity(); rigid = true; version++; return *this; }
+    void makeTranslationMatrix(float x, float y, float z) { lm::mat4::makeTranslationMatrix(x, y, z); rigid = true; version++; }
+    void makeTranslationMatrix(const lm::vec3& t) { lm::mat4::makeTranslationMatrix(t); rigid = true; version++; }
+    void makeRotationMatrix(float angle_in_rad, const lm::vec3& axis) { lm::mat4::makeRotationMatrix(angle_in_rad, axis); rigid = true; version++; }
+    void makeRotationMatrix(const lm::quat& normalized_quat) { lm::mat4::makeRotationMatrix(normalized_quat); rigid = true; version++; }
+    void makeScaleMatrix(float x, float y, float z) { lm::mat4::makeScaleMatrix(x, y, z); rigid = false; version++; }
+    void makeScaleMatrix(const lm::vec3& s) { lm::mat4::makeScaleMatrix(s); rigid = false; version++; }
+
+private:
+    //other mat4 functions which modify the matrix are hidden, so calling them
+    //on a transform fails to compile rather than leaving stale world matrices
+    using lm::mat4::m;
+    using lm::mat4::M;
+    using lm::mat4::clear;
+    using lm::mat4::transpose;
+    using lm::mat4::inverse;
+    using lm::mat4::inverseRigid;
+    using lm::mat4::affineInverse;
+    using lm::mat4::lookAt;
+    using lm::mat4::perspective;
+    using lm::mat4::orthographic;
 };
 
 // Mesh Component
@@ -47,6 +100,7 @@ struct Transform : public Component, public lm::mat4 {
 struct Mesh : public Component {
     int geometry;
     int material;
+    bool occluder = false; //large mesh drawn into the occlusion buffer
 };
 
 
@@ -119,7 +173,9 @@ struct Light : public Component {
 
 enum ColliderType {
     ColliderTypeBox,
-    ColliderTypeRay
+    ColliderTypeRay,
+    ColliderTypeSphere,
+    ColliderTypeMesh
 };
 
 //ColliderComponent. Only specifies size - collider location is given by any
@@ -129,22 +185,28 @@ enum ColliderType {
 // - local_halfwidth is used for box,
 // - direction is used for ray
 // - max_distance is used to convert ray to segment
+// - radius is used for sphere
+// - mesh_bvh is used for mesh, and is the index from CollisionSystem::loadMeshBVH
 struct Collider: public Component {
     ColliderType collider_type;
     lm::vec3 local_center; //offset from transform component
     lm::vec3 local_halfwidth; // for box
     lm::vec3 direction; // for ray
     float max_distance; // for segment
+    float radius; // for sphere
+    int mesh_bvh; // for mesh
     
     //collision state
     bool colliding;
-    int other;
+    int other; //entity of the other collider, or -1
     lm::vec3 collision_point;
     float collision_distance;
     
     Collider() {
         local_halfwidth = lm::vec3(0.5, 0.5, 0.5); //default dimensions = 1 in each axis
         max_distance = 10000000.0f; //infinite ray by default
+        radius = 0.5f; //default diameter = 1
+        mesh_bvh = -1; //no mesh
         colliding = false; // not colliding
         other = -1; //no other collider
     }
@@ -231,12 +293,15 @@ struct Entity {
     int components[NUM_TYPE_COMPONENTS];
     //sets active or not
     bool active = true;
+    //false once destroyed, until the slot is reused by a new entity
+    bool alive = true;
+    //incremented each time the slot is destroyed, so old handles can be detected
+    unsigned int generation = 0;
     
     Entity() {
         for (int i = 0; i < NUM_TYPE_COMPONENTS; i++) { components[i] = -1;}
     }
-    Entity(std::string a_name) : name(a_name) {
+    Entity(const std::string& a_name) : name(a_name) {
         for (int i = 0; i < NUM_TYPE_COMPONENTS; i++) { components[i] = -1;}
     }
 };
-
@@ -2,9 +2,22 @@
 #include "extern.h"
 
 //set initial state of input system
-void ControlSystem::init() {
+void ControlSystem::init(CollisionSystem* collision_system) {
 	//set all keys and buttons to 0
 	for (int i = 0; i < GLFW_KEY_LAST; i++) input[i] = 0;
+
+	//FPS rays point along world axes. Only the down ray looks far, to find the ground
+	collision_system_ = collision_system;
+	FPS_rays_[FPS_RAY_DOWN].direction = lm::vec3(0.0f, -1.0f, 0.0f);
+	FPS_rays_[FPS_RAY_DOWN].max_distance = 100.0f;
+	FPS_rays_[FPS_RAY_LEFT].direction = lm::vec3(-1.0f, 0.0f, 0.0f);
+	FPS_rays_[FPS_RAY_LEFT].max_distance = 1.0f;
+	FPS_rays_[FPS_RAY_RIGHT].direction = lm::vec3(1.0f, 0.0f, 0.0f);
+	FPS_rays_[FPS_RAY_RIGHT].max_distance = 1.0f;
+	FPS_rays_[FPS_RAY_FORWARD].direction = lm::vec3(0.0f, 0.0f, -1.0f);
+	FPS_rays_[FPS_RAY_FORWARD].max_distance = 1.0f;
+	FPS_rays_[FPS_RAY_BACK].direction = lm::vec3(0.0f, 0.0f, 1.0f);
+	FPS_rays_[FPS_RAY_BACK].max_distance = 1.0f;
 }
 
 //called from hardware input (via game)
@@ -25,6 +38,34 @@ void ControlSystem::updateMousePosition(int new_x, int new_y) {
 
 //called once per frame
 void ControlSystem::update(float dt) {
+	updateInput(dt);
+	updateCamera(dt);
+}
+
+//reads keys and mouse only, so it can run alongside anything which doesn't
+//need this frame's movement
+void ControlSystem::updateInput(float dt) {
+	float turn_speed_dt = turn_speed_ * dt;
+
+	//rotate camera if clicking the mouse
+	yaw_ = pitch_ = 0.0f;
+	if (input[GLFW_MOUSE_BUTTON_LEFT]) {
+		yaw_ = mouse.delta_x * turn_speed_dt;
+		pitch_ = mouse.delta_y * turn_speed_dt;
+	}
+
+	move_forward_ = (input[GLFW_KEY_W] ? 1.0f : 0.0f) - (input[GLFW_KEY_S] ? 1.0f : 0.0f);
+	move_strafe_ = (input[GLFW_KEY_D] ? 1.0f : 0.0f) - (input[GLFW_KEY_A] ? 1.0f : 0.0f);
+	jump_ = input[GLFW_KEY_SPACE];
+
+	//check if switch to Debug cam
+	next_camera_ = -1;
+	if (input[GLFW_KEY_O] == true) next_camera_ = 0; //debug cam is 0
+	if (input[GLFW_KEY_P] == true) next_camera_ = 1;
+}
+
+//moves the main camera as requested by updateInput
+void ControlSystem::updateCamera(float dt) {
 	if (control_type == ControlTypeFPS) {
 		updateFPS(dt);
 	}
@@ -32,12 +73,11 @@ void ControlSystem::update(float dt) {
 		updateFree(dt);
 	}
 
-	//check if switch to Debug cam
-	if (input[GLFW_KEY_O] == true) {
-		ECS.main_camera = 0; //debug cam is 0
+	if (next_camera_ == 0) {
+		ECS.main_camera = 0;
 		control_type = ControlTypeFree;
 	}
-	if (input[GLFW_KEY_P] == true) {
+	if (next_camera_ == 1) {
 		ECS.main_camera = 1;
 		control_type = ControlTypeFPS;
 	}
@@ -49,31 +89,28 @@ void ControlSystem::updateFree(float dt) {
 	Camera& camera = ECS.getComponentInArray<Camera>(ECS.main_camera);
 	Transform& transform = ECS.getComponentFromEntity<Transform>(camera.owner);
 
-	//multiply speeds by delta time 
+	//multiply speed by delta time 
 	float move_speed_dt = move_speed_ * dt;
-	float turn_speed_dt = turn_speed_ * dt;
 
 	//rotate camera if clicking the mouse - update camera.forward
-	if (input[GLFW_MOUSE_BUTTON_LEFT]) {
+	if (yaw_ != 0.0f || pitch_ != 0.0f) {
 		lm::mat4 R_yaw, R_pitch;
 
 		//yaw - axis is up vector of world
-		R_yaw.makeRotationMatrix(mouse.delta_x * turn_speed_dt, lm::vec3(0, 1, 0));
+		R_yaw.makeRotationMatrix(yaw_, lm::vec3(0, 1, 0));
 		camera.forward = R_yaw * camera.forward;
 
 		//pitch - axis is strafe vector of camera i.e cross product of cam_forward and up
 		lm::vec3 pitch_axis = camera.forward.normalize().cross(lm::vec3(0, 1, 0));
-		R_pitch.makeRotationMatrix(mouse.delta_y * turn_speed_dt, pitch_axis);
+		R_pitch.makeRotationMatrix(pitch_, pitch_axis);
 		camera.forward = R_pitch * camera.forward;
 	}
 
 	lm::vec3 forward_dir = camera.forward.normalize() * move_speed_dt;
 	lm::vec3 strafe_dir = camera.forward.cross(lm::vec3(0, 1, 0)) * move_speed_dt;
 
-	if (input[GLFW_KEY_W] == true)	transform.translate(forward_dir);
-	if (input[GLFW_KEY_S] == true)	transform.translate(forward_dir * -1);
-	if (input[GLFW_KEY_A] == true) 	transform.translate(strafe_dir*-1);
-	if (input[GLFW_KEY_D] == true) 	transform.translate(strafe_dir);
+	if (move_forward_ != 0.0f) transform.translate(forward_dir * move_forward_);
+	if (move_strafe_ != 0.0f) transform.translate(strafe_dir * move_strafe_);
 
 	//update camera position
 	camera.position = transform.position();
@@ -84,40 +121,40 @@ void ControlSystem::updateFPS(float dt) {
 	Camera& camera = ECS.getComponentInArray<Camera>(ECS.main_camera);
 	Transform& transform = ECS.getComponentFromEntity<Transform>(camera.owner);
 
-	//multiply speeds by delta time 
+	//multiply speed by delta time 
 	float move_speed_dt = move_speed_ * dt;
-	float turn_speed_dt = turn_speed_ * dt;
 
-	if (input[GLFW_MOUSE_BUTTON_LEFT]) {
+	if (yaw_ != 0.0f || pitch_ != 0.0f) {
 		//rotate camera just like Free movement
 		lm::mat4 R_yaw, R_pitch;
 		//yaw - axis is up vector of world
-		R_yaw.makeRotationMatrix(mouse.delta_x * turn_speed_dt, lm::vec3(0, 1, 0));
+		R_yaw.makeRotationMatrix(yaw_, lm::vec3(0, 1, 0));
 		camera.forward = R_yaw * camera.forward;
 		//pitch - axis is strafe vector of camera i.e cross product of cam_forward and up
 		lm::vec3 pitch_axis = camera.forward.normalize().cross(lm::vec3(0, 1, 0));
-		R_pitch.makeRotationMatrix(mouse.delta_y * turn_speed_dt, pitch_axis);
+		R_pitch.makeRotationMatrix(pitch_, pitch_axis);
 		camera.forward = R_pitch * camera.forward;
 	}
 
-	//fps control should have five ray colliders assigned
-	auto& colliders = ECS.getAllComponents<Collider>();
-	Collider& collider_down = colliders[FPS_collider_down];
-	Collider& collider_forward = colliders[FPS_collider_forward];
-	Collider& collider_left = colliders[FPS_collider_left];
-	Collider& collider_right = colliders[FPS_collider_right];
-	Collider& collider_back = colliders[FPS_collider_back];
+	//cast the five FPS rays from the player position against the colliders
+	for (int i = 0; i < FPS_RAY_COUNT; i++) FPS_rays_[i].origin = transform.position();
+	collision_system_->raycastBatch(FPS_rays_, FPS_hits_, FPS_RAY_COUNT);
+	CollisionSystem::Hit& hit_down = FPS_hits_[FPS_RAY_DOWN];
+	CollisionSystem::Hit& hit_forward = FPS_hits_[FPS_RAY_FORWARD];
+	CollisionSystem::Hit& hit_left = FPS_hits_[FPS_RAY_LEFT];
+	CollisionSystem::Hit& hit_right = FPS_hits_[FPS_RAY_RIGHT];
+	CollisionSystem::Hit& hit_back = FPS_hits_[FPS_RAY_BACK];
 
 	//collisions and gravity
 	//player down ray is always colliding, we need to keep player at 'FPS_height' units above nearest collider
-	float dist_above_ground = (transform.position() - collider_down.collision_point).length();
+	float dist_above_ground = (transform.position() - hit_down.point).length();
 	//collision test # 1
-	if (collider_down.colliding && dist_above_ground < FPS_height + 0.01f) // if below or on ground
+	if (hit_down.hit && dist_above_ground < FPS_height + 0.01f) // if below or on ground
 	{
 		//say we can jump
 		FPS_can_jump = true;
 		//force player to correct height above ground
-		transform.position(transform.position().x, collider_down.collision_point.y + FPS_height, transform.position().z);
+		transform.position(transform.position().x, hit_down.point.y + FPS_height, transform.position().z);
 	}
 	else { // we are in the air
 		if (FPS_jump_force > 0.0) {// slow down jump with time
@@ -131,16 +168,16 @@ void ControlSystem::updateFPS(float dt) {
 		transform.translate(0.0f, (FPS_jump_force - FPS_gravity)*dt, 0.0f);
 
 		//Collision test #2, as we might have moved down since test #1
-		dist_above_ground = (transform.position() - collider_down.collision_point).length();
-		if (collider_down.colliding && dist_above_ground < FPS_height + 0.01f) // if below or on ground
+		dist_above_ground = (transform.position() - hit_down.point).length();
+		if (hit_down.hit && dist_above_ground < FPS_height + 0.01f) // if below or on ground
 		{
 			//force player to correct height
-			transform.position(transform.position().x, collider_down.collision_point.y + FPS_height, transform.position().z);
+			transform.position(transform.position().x, hit_down.point.y + FPS_height, transform.position().z);
 		}
 	}
 
 	//jump
-	if (FPS_can_jump && input[GLFW_KEY_SPACE] == true) {
+	if (FPS_can_jump && jump_) {
 
 		//set jump state to false cos we don't want to double/multiple jump
 		FPS_can_jump = false;
@@ -159,19 +196,15 @@ void ControlSystem::updateFPS(float dt) {
 	forward_dir.y = 0.0;
 	strafe_dir.y = 0.0;
 	//now move
-	if (input[GLFW_KEY_W] == true && !collider_forward.colliding)
+	if (move_forward_ > 0.0f && !hit_forward.hit)
 		transform.translate(forward_dir);
-	if (input[GLFW_KEY_S] == true && !collider_back.colliding)
+	if (move_forward_ < 0.0f && !hit_back.hit)
 		transform.translate(forward_dir * -1.0f);
-	if (input[GLFW_KEY_A] == true && !collider_left.colliding)
+	if (move_strafe_ < 0.0f && !hit_left.hit)
 		transform.translate(strafe_dir * -1.0f);
-	if (input[GLFW_KEY_D] == true && !collider_right.colliding)
+	if (move_strafe_ > 0.0f && !hit_right.hit)
 		transform.translate(strafe_dir);
 
 	//update camera position
 	camera.position = transform.position();
-
-	//check if switch to Debug cam
-	if (input[GLFW_KEY_O] == true) ECS.main_camera = 0; //debug cam is 0
-	if (input[GLFW_KEY_P] == true) ECS.main_camera = 1;
 }
\ No newline at end of file
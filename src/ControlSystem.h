@@ -1,6 +1,7 @@
 #pragma once
 #include "includes.h"
 #include "Components.h"
+#include "CollisionSystem.h"
 #include <map>
 
 //struct to store mouse state
@@ -19,8 +20,13 @@ enum ControlType {
 //System which manages all our controls
 class ControlSystem {
 public:
-	void init();
+	void init(CollisionSystem* collision_system);
+	//updateInput turns key and mouse state into movement requests, without
+	//touching any component. updateCamera then moves the main camera, so the
+	//two can be scheduled apart. update calls both
 	void update(float dt);
+	void updateInput(float dt);
+	void updateCamera(float dt);
 
 	//functions called directly from main.cpp, via game
 	void updateMousePosition(int new_x, int new_y);
@@ -36,11 +42,6 @@ public:
 	Mouse mouse;
 
 	//FPS stuff
-	int FPS_collider_down;
-	int FPS_collider_left;
-	int FPS_collider_right;
-	int FPS_collider_forward;
-	int FPS_collider_back;
 	bool FPS_can_jump = true;
 	float FPS_jump_force = 0.0f;
 	float FPS_jump_initial_force = 12.0f;
@@ -54,6 +55,20 @@ private:
 
 	bool input[GLFW_KEY_LAST];
 
+	//movement requested by updateInput, applied by updateCamera
+	float yaw_ = 0.0f; //radians about world up
+	float pitch_ = 0.0f; //radians about camera strafe axis
+	float move_forward_ = 0.0f; //1 forward, -1 back
+	float move_strafe_ = 0.0f; //1 right, -1 left
+	bool jump_ = false;
+	int next_camera_ = -1; //camera to switch to, or -1 to keep
+
+	//FPS probe rays, cast from the player each frame in one batch
+	enum FPSRay { FPS_RAY_DOWN, FPS_RAY_LEFT, FPS_RAY_RIGHT, FPS_RAY_FORWARD, FPS_RAY_BACK, FPS_RAY_COUNT };
+	CollisionSystem* collision_system_ = nullptr;
+	CollisionSystem::Ray FPS_rays_[FPS_RAY_COUNT];
+	CollisionSystem::Hit FPS_hits_[FPS_RAY_COUNT];
+
 	//function to update entity movement
 	void updateFree(float dt);
 	void updateFPS(float dt);
@@ -8,7 +8,7 @@ DebugSystem::~DebugSystem() {
 	delete icon_shader_;
 }
 
-void DebugSystem::lateInit() {
+void DebugSystem::lateInit(CollisionSystem* collision_system) {
 	//init booleans
 	draw_grid_ = false;
 	draw_icons_ = false;
@@ -31,12 +31,8 @@ void DebugSystem::lateInit() {
 	icon_light_texture_ = Parsers::parseTexture("data/assets/icon_light.tga");
 	icon_camera_texture_ = Parsers::parseTexture("data/assets/icon_camera.tga");
 
-	//picking collider
-	ent_picking_ray_ = ECS.createEntity("picking_ray");
-	Collider& picking_ray = ECS.createComponentForEntity<Collider>(ent_picking_ray_);
-	picking_ray.collider_type = ColliderTypeRay;
-	picking_ray.direction = lm::vec3(0, 0, -1);
-	picking_ray.max_distance = 0.001f;
+	//picking is done with ray queries to the collision system
+	collision_system_ = collision_system;
 
 	setActive(true);
 }
@@ -60,20 +56,15 @@ void DebugSystem::update(float dt) {
 
 		//use line shader to draw all lines and boxes
 		glUseProgram(grid_shader_->program);
-		GLint u_mvp = glGetUniformLocation(grid_shader_->program, "u_mvp");
-		GLint u_color = glGetUniformLocation(grid_shader_->program, "u_color");
-		GLint u_color_mod = glGetUniformLocation(grid_shader_->program, "u_color_mod");
-		GLint u_size_scale = glGetUniformLocation(grid_shader_->program, "u_size_scale");
-		GLint u_center_mod = glGetUniformLocation(grid_shader_->program, "u_center_mod");
-
-
+		//locations were cached by the shader when it was linked
+		GLint u_mvp = grid_shader_->getUniformLocation(U_MVP);
+		GLint u_color = grid_shader_->getUniformLocation(U_COLOR);
+		GLint u_color_mod = grid_shader_->getUniformLocation(U_COLOR_MOD);
 
 		if (draw_grid_) {
 			//set uniforms and draw grid
 			glUniformMatrix4fv(u_mvp, 1, GL_FALSE, vp.m);
 			glUniform3fv(u_color, 4, grid_colors);
-			glUniform3f(u_size_scale, 1.0, 1.0, 1.0);
-			glUniform3f(u_center_mod, 0.0, 0.0, 0.0);
 			glUniform1i(u_color_mod, 0);
 			glBindVertexArray(grid_vao_); //GRID
 			glDrawElements(GL_LINES, grid_num_indices, GL_UNSIGNED_INT, 0);
@@ -106,12 +97,9 @@ void DebugSystem::update(float dt) {
 
 		if (draw_colliders_) {
 			//draw all colliders
-			auto& colliders = ECS.getAllComponents<Collider>();
-			for (auto& cc : colliders) {
-				//get transform for collider
-				Transform& tc = ECS.getComponentFromEntity<Transform>(cc.owner);
-				//get the colliders local model matrix in order to draw correctly
-				lm::mat4 collider_matrix = tc.getGlobalMatrix(ECS.getAllComponents<Transform>());
+			ECS.view<Collider, Transform>().each([&](Collider& cc, Transform& tc) {
+				//get the colliders world matrix in order to draw correctly
+				lm::mat4 collider_matrix = ECS.getWorldMatrix(tc);
 
 				if (cc.collider_type == ColliderTypeBox) {
 
@@ -164,7 +152,7 @@ void DebugSystem::update(float dt) {
 					glBindVertexArray(collider_ray_vao_);
 					glDrawElements(GL_LINES, 2, GL_UNSIGNED_INT, 0);
 				}
-			}
+			});
 		}
 	}
 
@@ -173,8 +161,8 @@ void DebugSystem::update(float dt) {
 		glUseProgram(icon_shader_->program);
 
 		//get uniforms
-		GLint u_mvp = glGetUniformLocation(icon_shader_->program, "u_mvp");
-		GLint u_icon = glGetUniformLocation(icon_shader_->program, "u_icon");
+		GLint u_mvp = icon_shader_->getUniformLocation(U_MVP);
+		GLint u_icon = icon_shader_->getUniformLocation(U_ICON);
 		glUniform1i(u_icon, 0);
 
 
@@ -182,11 +170,8 @@ void DebugSystem::update(float dt) {
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, icon_light_texture_);
 
-		auto& lights = ECS.getAllComponents<Light>();
-		for (auto& curr_light : lights) {
-			Transform& curr_light_transform = ECS.getComponentFromEntity<Transform>(curr_light.owner);
-
-			lm::mat4 mvp_matrix = vp * curr_light_transform.getGlobalMatrix(ECS.getAllComponents<Transform>());;
+		ECS.view<Light, Transform>().each([&](Light&, Transform& curr_light_transform) {
+			lm::mat4 mvp_matrix = vp * ECS.getWorldMatrix(curr_light_transform);
 			//BILLBOARDS
 			//the mvp for the light contains rotation information. We want it to look at the camera always.
 			//So we zero out first three columns of matrix, which contain the rotation information
@@ -198,17 +183,15 @@ void DebugSystem::update(float dt) {
 			glUniformMatrix4fv(u_mvp, 1, GL_FALSE, bill_matrix.m);
 			glBindVertexArray(icon_vao_);
 			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
-		}
+		});
 
 		//bind camera texture
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, icon_camera_texture_);
 
 		//for each camera, exactly the same but with camera texture
-		auto& cameras = ECS.getAllComponents<Camera>();
-		for (auto& curr_camera : cameras) {
-			Transform& curr_cam_transform = ECS.getComponentFromEntity<Transform>(curr_camera.owner);
-			lm::mat4 mvp_matrix = vp * curr_cam_transform.getGlobalMatrix(ECS.getAllComponents<Transform>());
+		ECS.view<Camera, Transform>().each([&](Camera&, Transform& curr_cam_transform) {
+			lm::mat4 mvp_matrix = vp * ECS.getWorldMatrix(curr_cam_transform);
 
 			// billboard as above
 			lm::mat4 bill_matrix;
@@ -217,7 +200,7 @@ void DebugSystem::update(float dt) {
 			glBindVertexArray(icon_vao_);
 			glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
 
-		}
+		});
 	}
 	glBindVertexArray(0);
 
@@ -229,11 +212,11 @@ void DebugSystem::update(float dt) {
 void imGuiRenderTransformNode(TransformNode& trans) {
 	auto& ent = ECS.entities[trans.entity_owner];
 	if (ImGui::TreeNode(ent.name.c_str())) {
-		Transform& transform = ECS.getComponentFromEntity<Transform>(ent.name);
+		Transform& transform = ECS.getComponentFromEntity<Transform>(trans.entity_owner);
 		lm::vec3 pos = transform.position();
 		float pos_array[3] = { pos.x, pos.y, pos.z };
-		ImGui::DragFloat3("Position", pos_array);
-		transform.position(pos_array[0], pos_array[1], pos_array[2]);
+		if (ImGui::DragFloat3("Position", pos_array))
+			transform.position(pos_array[0], pos_array[1], pos_array[2]);
 		for (auto& child : trans.children) {
 
 			imGuiRenderTransformNode(child);
@@ -306,14 +289,14 @@ void DebugSystem::updateimGUI_(float dt) {
 			tn.trans_id = (int)i;
 			tn.entity_owner = all_transforms[i].owner;
 			tn.ent_name = ECS.entities[tn.entity_owner].name;
-			if (all_transforms[i].parent == -1)
+			if (ECS.getParentTransform((int)i) == -1)
 				tn.isTop = true;
 			transform_nodes.push_back(tn);
 		}
         
 		// 2) traverse array to assign children to their parents
 		for (size_t i = 0; i < transform_nodes.size(); i++) {
-			int parent = all_transforms[i].parent;
+			int parent = ECS.getParentTransform((int)i);
 			if (parent != -1) {
 				transform_nodes[parent].children.push_back(transform_nodes[i]);
 			}
@@ -339,29 +322,28 @@ void DebugSystem::updateimGUI_(float dt) {
 		}
 
         //*** PICKING*** //
-        //general approach: Debug System has a member variable which is an entity
-        //with Ray Collider (ent_picking_ray_). When user clicks on the screen, this
-        //ray is fired into the scene.
-        //if it collides with a box collider, we read that collision here and render
-        //imGUI with the details of the collider
+        //general approach: Debug System has a member variable which is a ray
+        //(picking_ray_). When user clicks on the screen, this ray is fired into the scene.
+        //we trace it against the colliders here, and if it hits a box collider
+        //render imGUI with the details of the collider
         
         //look at DebugSystem::setPickingRay_() to see how picking ray is constructed
         
         //next column for picking
 		ImGui::NextColumn();
     
-		//get the pick ray first
-		Collider& pick_ray_collider = ECS.getComponentFromEntity<Collider>(ent_picking_ray_);
+		//trace the pick ray first, so moving colliders stay picked
+		if (has_picking_ray_)
+			collision_system_->raycastBatch(&picking_ray_, &picking_hit_, 1);
 
 		//is it colliding? if so, get pitcked, entity, and transform, and render imGUI text
 		int picked_entity = -1;
-		if (pick_ray_collider.colliding) {
-			//get the other collider and entity
-			Collider& picked_collider = ECS.getComponentInArray<Collider>(pick_ray_collider.other);
-			picked_entity = picked_collider.owner;
+		if (has_picking_ray_ && picking_hit_.hit) {
+			//get the entity of the collider which was hit
+			picked_entity = picking_hit_.entity;
 			Transform& picked_transform = ECS.getComponentFromEntity<Transform>(picked_entity);
 			ImGui::Text("Selected entity:");
-			ImGui::TextColored(ImVec4(1, 1, 0, 1), ECS.entities[picked_collider.owner].name.c_str());
+			ImGui::TextColored(ImVec4(1, 1, 0, 1), ECS.entities[picked_entity].name.c_str());
 		}
 
 
@@ -400,12 +382,11 @@ void DebugSystem::setPickingRay(int mouse_x, int mouse_y, int screen_width, int
 	lm::vec3 mouse_world_3(mouse_world.x, mouse_world.y, mouse_world.z);
 
     //set the picking ray
-    //the actual collision detection will be done next frame in the CollisionSystem
-	Transform& pick_ray_transform = ECS.getComponentFromEntity<Transform>(ent_picking_ray_);
-	Collider& pick_ray_collider = ECS.getComponentFromEntity<Collider>(ent_picking_ray_);
-	pick_ray_transform.position(cam.position);
-	pick_ray_collider.direction = (mouse_world_3 - cam.position).normalize();
-	pick_ray_collider.max_distance = 1000000;
+    //the actual collision detection will be done in update, via the CollisionSystem
+	picking_ray_.origin = cam.position;
+	picking_ray_.direction = (mouse_world_3 - cam.position).normalize();
+	picking_ray_.max_distance = 1000000;
+	has_picking_ray_ = true;
 }
 
 ///////////////////////////////////////////////
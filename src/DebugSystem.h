@@ -1,6 +1,7 @@
 #pragma once
 #include "includes.h"
 #include "Shader.h"
+#include "CollisionSystem.h"
 #include <vector>
 
 
@@ -15,7 +16,7 @@ struct TransformNode {
 class DebugSystem {
 public:
 	~DebugSystem();
-	void lateInit();
+	void lateInit(CollisionSystem* collision_system);
 	void update(float dt);
 
 	void setActive(bool a);
@@ -67,9 +68,12 @@ private:
 	bool show_imGUI_ = false;
 	void updateimGUI_(float dt);
 
-	//picking
+	//picking - ray is fired from setPickingRay, and traced each frame in update
 	bool can_fire_picking_ray_ = true;
-	int ent_picking_ray_;
+	bool has_picking_ray_ = false;
+	CollisionSystem* collision_system_ = nullptr;
+	CollisionSystem::Ray picking_ray_;
+	CollisionSystem::Hit picking_hit_;
 	
 };
 
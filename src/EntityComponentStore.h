@@ -1,8 +1,11 @@
 #pragma once
 #include "Components.h"
+#include "JobSystem.h"
 #include <vector>
 #include <unordered_map>
 #include <map>
+#include <algorithm>
+#include <type_traits>
 
 using namespace std;
 
@@ -17,19 +20,58 @@ struct EntityComponentStore {
     
     ComponentArrays components; // defined at bottom of Components.h
     
-    //create Entity and add transform component by default
+    //create Entity and add transform component by default, reusing the slot
+    //of a destroyed entity if there is one
     //return array id of new entity
-    int createEntity(string name) {
-        entities.emplace_back(name);
-        createComponentForEntity<Transform>((int)entities.size() - 1);
-        return (int)entities.size() - 1;
+    int createEntity(const string& name) {
+        int entity_id;
+        if (!free_entities_.empty()) {
+            entity_id = free_entities_.back();
+            free_entities_.pop_back();
+            unsigned int generation = entities[entity_id].generation;
+            entities[entity_id] = Entity(name);
+            entities[entity_id].generation = generation;
+        }
+        else {
+            entities.emplace_back(name);
+            entity_id = (int)entities.size() - 1;
+        }
+        //if the name is taken, lookup keeps returning the existing entity
+        entity_names_[name].push_back(entity_id);
+        createComponentForEntity<Transform>(entity_id);
+        return entity_id;
     }
 
-	//returns id of entity
-	int getEntity(string name) {
-		for (size_t i = 0; i < entities.size(); i++)
-			if (entities[i].name == name) return (int)i;
-		return -1;
+    //removes all components of entity and frees its slot for reuse.
+    //Children of the entity's transform become root transforms
+    void destroyEntity(int entity_id) {
+        removeComponents_<0>(entity_id);
+        Entity& ent = entities[entity_id];
+        removeEntityName_(entity_id);
+        ent.name = "";
+        ent.alive = false;
+        ent.generation++;
+        free_entities_.push_back(entity_id);
+    }
+
+    //returns a handle which can be checked with isValid after entity is destroyed
+    EntityHandle getHandle(int entity_id) {
+        EntityHandle handle;
+        handle.id = entity_id;
+        handle.generation = entities[entity_id].generation;
+        return handle;
+    }
+
+    //true if handle's entity has not been destroyed
+    bool isValid(EntityHandle handle) {
+        return handle.id >= 0 && handle.id < (int)entities.size() &&
+            entities[handle.id].alive && entities[handle.id].generation == handle.generation;
+    }
+
+	//returns id of entity, or -1 if there is no entity with this name
+	int getEntity(const string& name) {
+		auto it = entity_names_.find(name);
+		return it != entity_names_.end() ? it->second.front() : -1;
 	}
     
     //creates a new component with no entity parent
@@ -64,6 +106,56 @@ struct EntityComponentStore {
         return the_vec.back(); // return pointer to new component
     }
     
+    //removes component of type T from entity. The last component in the array
+    //is moved into the freed slot, so removal doesn't leave holes
+    template<typename T>
+    void removeComponent(int entity_id) {
+        vector<T>& the_vec = get<vector<T>>(components);
+        const int type_index = type2int<T>::result;
+        const int removed = entities[entity_id].components[type_index];
+        if (removed == -1) return;
+        const int last = (int)the_vec.size() - 1;
+        removingComponent_((T*)nullptr, removed, last);
+
+        //swap and pop
+        if (removed != last) {
+            the_vec[removed] = std::move(the_vec[last]);
+            entities[the_vec[removed].owner].components[type_index] = removed;
+        }
+        the_vec.pop_back();
+        entities[entity_id].components[type_index] = -1;
+
+        //fix anything which refers to components of this type by index
+        remapReferences_((T*)nullptr, [removed, last](int id) {
+            if (id == removed) return -1;
+            if (id == last) return removed;
+            return id;
+        });
+    }
+
+    //sorts components of type T with comparison function, updating entities
+    //and anything else which refers to them by index
+    template<typename T, typename Compare>
+    void sortComponents(Compare compare) {
+        vector<T>& the_vec = get<vector<T>>(components);
+        const int type_index = type2int<T>::result;
+
+        //store old index of each component before sorting
+        for (size_t i = 0; i < the_vec.size(); i++)
+            the_vec[i].index = (int)i;
+        std::stable_sort(the_vec.begin(), the_vec.end(), compare);
+
+        vector<int> old_new(the_vec.size());
+        for (size_t i = 0; i < the_vec.size(); i++) {
+            old_new[the_vec[i].index] = (int)i;
+            entities[the_vec[i].owner].components[type_index] = (int)i;
+        }
+        remapReferences_((T*)nullptr, [&old_new](int id) {
+            return id == -1 ? -1 : old_new[id];
+        });
+        reorderedComponents_((T*)nullptr);
+    }
+
     //return reference to component at id in array
     template<typename T>
     T& getComponentInArray(int an_id) {
@@ -83,7 +175,7 @@ struct EntityComponentStore {
 
 	//return reference to component stored in entity, accessed by name
 	template<typename T>
-	T& getComponentFromEntity(std::string entity_name) {
+	T& getComponentFromEntity(const std::string& entity_name) {
 		//get entity id
 		const int entity_id = getEntity(entity_name);
 		//get index for type
@@ -103,6 +195,57 @@ struct EntityComponentStore {
         return entities[entity_id].components[type_index];
     }
     
+    //return id in its array of a component stored in the ECS
+    template<typename T>
+    int getComponentIndex(const T& comp) {
+        return (int)(&comp - &get<vector<T>>(components)[0]);
+    }
+
+    //iterates all entities which have every component in Ts, see view()
+    template<typename... Ts>
+    struct View {
+        EntityComponentStore& ecs;
+
+        //calls fn(Ts&...) for each entity with all Ts. Walks the array of the
+        //type with fewest components (the first one on ties), in its order
+        template<typename F>
+        void each(F fn) {
+            size_t sizes[] = { get<vector<Ts>>(ecs.components).size()... };
+            int (EntityComponentStore::*owner_of[])(int) = { &EntityComponentStore::ownerOf_<Ts>... };
+            size_t smallest = 0;
+            for (size_t k = 1; k < sizeof...(Ts); k++)
+                if (sizes[k] < sizes[smallest]) smallest = k;
+
+            for (size_t i = 0; i < sizes[smallest]; i++) {
+                Entity& ent = ecs.entities[(ecs.*owner_of[smallest])((int)i)];
+                bool has_all = true;
+                int type_ids[] = { type2int<Ts>::result... };
+                for (int type_id : type_ids)
+                    if (ent.components[type_id] == -1) has_all = false;
+                if (!has_all) continue;
+                fn(get<vector<Ts>>(ecs.components)[ent.components[type2int<Ts>::result]]...);
+            }
+        }
+    };
+
+    //e.g. ECS.view<Mesh, Transform>().each([](Mesh& mesh, Transform& transform) { ... });
+    template<typename... Ts>
+    View<Ts...> view() {
+        return View<Ts...>{ *this };
+    }
+
+    //sorts components of type Follow into the order of their entity's Lead
+    //component, so that a view<Lead, Follow> reads both arrays sequentially.
+    //Components whose entity has no Lead go to the end
+    template<typename Lead, typename Follow>
+    void packComponents() {
+        const int lead_index = type2int<Lead>::result;
+        sortComponents<Follow>([this, lead_index](const Follow& a, const Follow& b) {
+            return (unsigned int)entities[a.owner].components[lead_index] <
+                (unsigned int)entities[b.owner].components[lead_index];
+        });
+    }
+
     //returns a const (i.e. non-editable) reference to vector of Type
     //i.e. array will not be editable
     template<typename T>
@@ -111,5 +254,274 @@ struct EntityComponentStore {
     }
     //stores main camera id
     int main_camera = -1;
-    
+
+	//world matrix of each transform, indexed like the transform array.
+	//Valid after updateWorldMatrices, which should be called once local
+	//matrices have been changed for the frame
+	vector<lm::mat4> world_matrices;
+	//inverse transpose of each world matrix, for transforming normals
+	vector<lm::mat4> normal_matrices;
+	//incremented whenever a world matrix is recalculated, so systems can
+	//cache data derived from it and only update it when this changes
+	vector<unsigned int> world_versions;
+
+	//returns cached world matrix of transform
+	const lm::mat4& getWorldMatrix(int transform_id) {
+		return world_matrices[transform_id];
+	}
+
+	//returns cached world matrix of a transform component stored in the ECS
+	const lm::mat4& getWorldMatrix(const Transform& transform) {
+		return world_matrices[getComponentIndex(transform)];
+	}
+
+	//returns cached normal matrix of transform
+	const lm::mat4& getNormalMatrix(int transform_id) {
+		return normal_matrices[transform_id];
+	}
+
+	//returns id of the parent transform of a transform, or -1 if it is a root
+	int getParentTransform(int transform_id) {
+		return parentTransform_(get<vector<Transform>>(components)[transform_id]);
+	}
+
+	//recalculates world matrices level by level, with parents before children.
+	//Only transforms whose local matrix, or whose parent's world matrix,
+	//changed since the last call are recalculated. If jobs is given, each
+	//level of the hierarchy is split across its workers
+	void updateWorldMatrices(JobSystem* jobs = nullptr) {
+		vector<Transform>& transforms = get<vector<Transform>>(components);
+		size_t num_transforms = transforms.size();
+
+		//rebuild the order if transforms were added, removed, moved or reparented
+		bool hierarchy_changed = transforms_moved_ || num_transforms != world_parents_.size();
+		transforms_moved_ = false;
+		for (size_t i = 0; !hierarchy_changed && i < num_transforms; i++)
+			hierarchy_changed = parentTransform_(transforms[i]) != world_parents_[i];
+		if (hierarchy_changed) sortTransformHierarchy_();
+
+		world_dirty_.assign(num_transforms, hierarchy_changed ? 1 : 0);
+		for (size_t level = 0; level + 1 < world_level_starts_.size(); level++) {
+			size_t first = world_level_starts_[level];
+			size_t count = world_level_starts_[level + 1] - first;
+			auto update_range = [this, &transforms, first](size_t begin, size_t end) {
+				for (size_t k = first + begin; k < first + end; k++)
+					updateWorldMatrix_(transforms, world_order_[k]);
+			};
+			if (jobs) jobs->parallelFor(count, WORLD_MATRIX_CHUNK, update_range);
+			else update_range(0, count);
+		}
+	}
+
+private:
+	vector<int> free_entities_; //slots of destroyed entities
+	//name index for getEntity. Entities sharing a name are listed in the
+	//order they were created, and lookup returns the first
+	unordered_map<string, vector<int>> entity_names_;
+
+	//removes entity from the list of its name. If it was first, the next
+	//entity created with the same name takes over the name
+	void removeEntityName_(int entity_id) {
+		auto it = entity_names_.find(entities[entity_id].name);
+		if (it == entity_names_.end()) return;
+		vector<int>& ids = it->second;
+		auto pos = std::find(ids.begin(), ids.end(), entity_id);
+		if (pos != ids.end()) ids.erase(pos);
+		if (ids.empty()) entity_names_.erase(it);
+	}
+
+	template<typename T>
+	int ownerOf_(int comp_id) { return get<vector<T>>(components)[comp_id].owner; }
+
+	//removes every component of entity, walking the ComponentArrays tuple
+	template<int I>
+	typename std::enable_if<(I == NUM_TYPE_COMPONENTS)>::type removeComponents_(int) {}
+	template<int I>
+	typename std::enable_if<(I < NUM_TYPE_COMPONENTS)>::type removeComponents_(int entity_id) {
+		typedef typename std::tuple_element<I, ComponentArrays>::type::value_type T;
+		removeComponent<T>(entity_id);
+		removeComponents_<I + 1>(entity_id);
+	}
+
+	//called when components move in their array. remap(old_id) returns the
+	//new id, or -1 if removed. Types referred to by index elsewhere overload
+	//this, and must only touch a fixed number of references so that removal
+	//stays O(1). Components refer to each other by entity instead
+	template<typename T, typename Remap>
+	void remapReferences_(T*, Remap) {}
+	template<typename Remap>
+	void remapReferences_(Camera*, Remap remap) {
+		if (main_camera != -1) main_camera = remap(main_camera);
+	}
+
+	//called before component removed is deleted and last moved into its slot
+	template<typename T>
+	void removingComponent_(T*, int, int) {}
+	void removingComponent_(Transform*, int removed, int last) { removeFromWorldOrder_(removed, last); }
+	//called after components of type T were reordered
+	template<typename T>
+	void reorderedComponents_(T*) {}
+	void reorderedComponents_(Transform*) { transforms_moved_ = true; }
+
+	//transform id of the parent entity's transform, or -1
+	int parentTransform_(const Transform& t) {
+		if (!isValid(t.parent)) return -1;
+		return entities[t.parent.id].components[type2int<Transform>::result];
+	}
+
+	bool transforms_moved_ = false;
+	vector<int> world_order_; //transform ids, parents before children
+	vector<size_t> world_level_starts_; //start of each depth in world_order_, plus end
+	vector<int> world_parents_; //parent transform ids when order was last built
+	vector<size_t> world_positions_; //index of each transform in world_order_
+	vector<size_t> world_depths_; //level of each transform in world_order_
+	vector<vector<int>> world_children_; //child transform ids, from world_parents_
+	vector<size_t> world_child_slots_; //index of each transform in its parent's children
+	vector<unsigned int> local_versions_; //transform versions at last update
+	vector<char> world_dirty_;
+	vector<char> world_rigid_; //world matrix has no scale, set with world matrix
+
+	//transforms per job when updating world matrices in parallel
+	static const size_t WORLD_MATRIX_CHUNK = 256;
+
+	//recalculates world matrix of transform if it or its parent changed.
+	//Only writes to the transform's own slots, so a level can run in parallel
+	void updateWorldMatrix_(vector<Transform>& transforms, int id) {
+		Transform& t = transforms[id];
+		//local matrix changed
+		if (t.version != local_versions_[id]) {
+			local_versions_[id] = t.version;
+			world_dirty_[id] = 1;
+		}
+		//parent is in an earlier level, so dirt propagates down the subtree
+		int parent = world_parents_[id];
+		if (parent != -1 && world_dirty_[parent])
+			world_dirty_[id] = 1;
+		if (!world_dirty_[id]) return;
+
+		if (parent != -1)
+			world_matrices[id] = world_matrices[parent] * t;
+		else
+			world_matrices[id] = t;
+
+		//world matrix is rigid only if every transform up the hierarchy is
+		world_rigid_[id] = t.rigid && (parent == -1 || world_rigid_[parent]);
+		lm::mat4& normal_matrix = normal_matrices[id];
+		if (world_rigid_[id]) {
+			normal_matrix = world_matrices[id];
+			normal_matrix.position(0.0f, 0.0f, 0.0f);
+		}
+		else
+			normal_matrix = world_matrices[id].normalMatrix();
+
+		world_versions[id]++;
+	}
+
+	//orders transforms by depth in hierarchy so parents come before children,
+	//walking down from the roots through the children of each level
+	void sortTransformHierarchy_() {
+		vector<Transform>& transforms = get<vector<Transform>>(components);
+		size_t num_transforms = transforms.size();
+
+		world_parents_.resize(num_transforms);
+		world_children_.assign(num_transforms, vector<int>());
+		world_child_slots_.resize(num_transforms);
+		for (size_t i = 0; i < num_transforms; i++) {
+			int parent = parentTransform_(transforms[i]);
+			world_parents_[i] = parent;
+			if (parent == -1) continue;
+			world_child_slots_[i] = world_children_[parent].size();
+			world_children_[parent].push_back((int)i);
+		}
+
+		world_order_.clear();
+		world_level_starts_.clear();
+		world_positions_.resize(num_transforms);
+		world_depths_.resize(num_transforms);
+		for (size_t i = 0; i < num_transforms; i++)
+			if (world_parents_[i] == -1) world_order_.push_back((int)i);
+		size_t level_start = 0;
+		while (level_start < world_order_.size()) {
+			size_t level_end = world_order_.size();
+			world_level_starts_.push_back(level_start);
+			for (size_t k = level_start; k < level_end; k++) {
+				int id = world_order_[k];
+				world_positions_[id] = k;
+				world_depths_[id] = world_level_starts_.size() - 1;
+				for (int child : world_children_[id]) world_order_.push_back(child);
+			}
+			level_start = level_end;
+		}
+		world_level_starts_.push_back(world_order_.size());
+
+		world_matrices.resize(num_transforms);
+		normal_matrices.resize(num_transforms);
+		world_versions.resize(num_transforms, 0);
+		local_versions_.resize(num_transforms, 0);
+		world_rigid_.resize(num_transforms, 0);
+	}
+
+	//patches the order for transform removed being deleted and last moved
+	//into its slot, touching only them, their parents and last's children.
+	//Falls back to a full sort if removed has children, which become roots
+	void removeFromWorldOrder_(int removed, int last) {
+		if (transforms_moved_ || world_parents_.size() != (size_t)last + 1 || !world_children_[removed].empty()) {
+			transforms_moved_ = true;
+			return;
+		}
+
+		//take removed out of its parent's children
+		int parent = world_parents_[removed];
+		if (parent != -1) {
+			vector<int>& siblings = world_children_[parent];
+			int moved = siblings.back();
+			siblings[world_child_slots_[removed]] = moved;
+			world_child_slots_[moved] = world_child_slots_[removed];
+			siblings.pop_back();
+		}
+
+		//fill its place with the last transform of its level, then that place
+		//with the last of the next level and so on, so the hole ends up last
+		size_t hole = world_positions_[removed];
+		for (size_t level = world_depths_[removed]; level + 1 < world_level_starts_.size(); level++) {
+			size_t level_last = --world_level_starts_[level + 1];
+			if (level_last == hole) continue;
+			int moved = world_order_[level_last];
+			world_order_[hole] = moved;
+			world_positions_[moved] = hole;
+			hole = level_last;
+		}
+		world_order_.pop_back();
+
+		//last takes the id of removed
+		if (removed != last) {
+			world_order_[world_positions_[last]] = removed;
+			world_positions_[removed] = world_positions_[last];
+			world_depths_[removed] = world_depths_[last];
+			world_parents_[removed] = world_parents_[last];
+			world_child_slots_[removed] = world_child_slots_[last];
+			if (world_parents_[last] != -1)
+				world_children_[world_parents_[last]][world_child_slots_[last]] = removed;
+			world_children_[removed].swap(world_children_[last]);
+			for (int child : world_children_[removed]) world_parents_[child] = removed;
+
+			world_matrices[removed] = world_matrices[last];
+			normal_matrices[removed] = normal_matrices[last];
+			world_rigid_[removed] = world_rigid_[last];
+			//recalculated next update, with a version newer than either had
+			if (world_versions[last] > world_versions[removed]) world_versions[removed] = world_versions[last];
+			local_versions_[removed] = 0;
+		}
+
+		world_parents_.pop_back();
+		world_positions_.pop_back();
+		world_depths_.pop_back();
+		world_children_.pop_back();
+		world_child_slots_.pop_back();
+		world_matrices.pop_back();
+		normal_matrices.pop_back();
+		world_versions.pop_back();
+		local_versions_.pop_back();
+		world_rigid_.pop_back();
+	}
 };
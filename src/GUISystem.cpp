@@ -85,10 +85,10 @@ void GUISystem::update(float dt) {
 		model.translate(el.offset.x, el.offset.y, 0);
 
 		//set uniforms
-		GLint u_mvp = glGetUniformLocation(icon_shader_->program, "u_mvp");
+		GLint u_mvp = icon_shader_->getUniformLocation(U_MVP);
 		glUniformMatrix4fv(u_mvp, 1, GL_FALSE, (view_projection * model).m);
 
-		GLint u_icon = glGetUniformLocation(icon_shader_->program, "u_icon");
+		GLint u_icon = icon_shader_->getUniformLocation(U_ICON);
 		glUniform1i(u_icon, 10);
 
 		glActiveTexture(GL_TEXTURE0 + 10);
@@ -117,13 +117,13 @@ void GUISystem::update(float dt) {
 		model.translate(el.offset.x, el.offset.y, 0);
 
 		//set uniforms
-		GLint u_mvp = glGetUniformLocation(text_shader_->program, "u_mvp");
+		GLint u_mvp = text_shader_->getUniformLocation(U_MVP);
 		glUniformMatrix4fv(u_mvp, 1, GL_FALSE, (view_projection * model).m);
 
-		GLint u_color = glGetUniformLocation(text_shader_->program, "u_color");
+		GLint u_color = text_shader_->getUniformLocation(U_COLOR);
 		glUniform3fv(u_color, 1, el.color.value_);
 
-		GLint u_icon = glGetUniformLocation(text_shader_->program, "u_icon");
+		GLint u_icon = text_shader_->getUniformLocation(U_ICON);
 		glUniform1i(u_icon, 10);
 
 		glActiveTexture(GL_TEXTURE0 + 10);
@@ -18,9 +18,15 @@ void Game::init() {
 
 	//******* INIT SYSTEMS *******
 
+	//worker threads for systems which don't need the GL context
+	JOBS.init();
+	scheduler_.init(&JOBS);
+
 	//init systems except debug, which needs info about scene
-	control_system_.init();
+	control_system_.init(&collision_system_);
 	graphics_system_.init(window_width_, window_height_, "data/assets/");
+	//the arena only saves draw calls when they can be merged
+	graphics_system_.useGeometryArena(graphics_system_.hasMultiDrawIndirect());
     script_system_.init(&control_system_);
 	gui_system_.init(window_width_, window_height_);
 
@@ -40,6 +46,8 @@ void Game::init() {
 	sphere_mesh.material = graphics_system_.createMaterial();
 	Material& sphere_mat = graphics_system_.getMaterial(sphere_mesh.material);
 	sphere_mat.shader_id = ubo_test_shader->program;
+	sphere_mat.diffuse = lm::vec3(1.0f, 0.0f, 1.0f); //ubo_test mixes diffuse and specular
+	sphere_mat.specular = lm::vec3(0.0f, 1.0f, 0.0f);
 
 
 
@@ -90,14 +98,16 @@ void Game::init() {
 
 	
 
-	//Parsers::parseJSONLevel("data/assets/lightcasters.json", graphics_system_, control_system_);
+	//Parsers::parseJSONLevel("data/assets/lightcasters.json", graphics_system_, control_system_, collision_system_);
     
     
     
     //******* LATE INIT AFTER LOADING RESOURCES *******//
     graphics_system_.lateInit();
     script_system_.lateInit();
-    debug_system_.lateInit();
+    debug_system_.lateInit(&collision_system_);
+
+	scheduleSystems_();
 
 }
 
@@ -106,25 +116,60 @@ void Game::update(float dt) {
 
 	if (ECS.getAllComponents<Camera>().size() == 0) {print("There is no camera set!"); return;}
 
-	//update input
-	control_system_.update(dt);
-
-	//collision
-	collision_system_.update(dt);
+	//run systems through the scheduler, see scheduleSystems_()
+	scheduler_.run(dt);
+   
+}
 
-	//scripts
-	script_system_.update(dt);
+//registers each system's frame update with the scheduler, in the order they
+//would run on one thread, with the components and resources each one uses
+void Game::scheduleSystems_() {
+	const AccessMask gl = resourceMask(RESOURCE_GL);
+	const AccessMask input = resourceMask(RESOURCE_INPUT);
+	const AccessMask control = resourceMask(RESOURCE_CONTROL);
+	const AccessMask world = resourceMask(RESOURCE_WORLD_MATRICES);
+	const AccessMask render_state = resourceMask(RESOURCE_RENDER_STATE);
+	const AccessMask collision = resourceMask(RESOURCE_COLLISION_WORLD);
+
+	//update input, touches no components
+	scheduler_.addTask("control input", input, control,
+		[this](float dt) { control_system_.updateInput(dt); });
+
+	//scripts use what they declared, so ones that leave the camera alone
+	//run alongside control input
+	scheduler_.addTask("scripts", script_system_.getReads(), script_system_.getWrites(),
+		[this](float dt) { script_system_.update(dt); });
+
+	//move the main camera, probing last frame's collision world
+	scheduler_.addTask("camera", control | collision, componentMask<Transform, Camera>(),
+		[this](float dt) { control_system_.updateCamera(dt); });
+
+	//world matrices once everything has moved
+	scheduler_.addTask("world matrices", componentMask<Transform>(), world,
+		[](float) { ECS.updateWorldMatrices(&JOBS); });
+
+	//collision and graphics prepare only share reads of the world matrices
+	//and transforms, so they run in the same wave
+	scheduler_.addTask("collision", world | componentMask<Transform>(), componentMask<Collider>() | collision,
+		[this](float dt) { collision_system_.update(dt); });
+
+	//cameras, culling and batching
+	scheduler_.addTask("graphics prepare", world | componentMask<Mesh, Light, Transform>(), componentMask<Camera>() | render_state,
+		[this](float dt) { graphics_system_.prepareFrame(dt); });
 
 	//render
-	graphics_system_.update(dt);
-    
+	scheduler_.addTask("graphics render", render_state, gl,
+		[this](float) { graphics_system_.renderFrame(); });
+
 	//gui
-	gui_system_.update(dt);
+	scheduler_.addTask("gui", input | componentMask<GUIElement, GUIText>(), gl,
+		[this](float dt) { gui_system_.update(dt); });
 
 	//debug
-	debug_system_.update(dt);
-   
+	scheduler_.addTask("debug", world | collision | allComponentsMask(), gl | componentMask<Transform>(),
+		[this](float dt) { debug_system_.update(dt); });
 }
+
 //update game viewports
 void Game::update_viewports(int window_width, int window_height) {
 	window_width_ = window_width;
@@ -164,54 +209,8 @@ int Game::createPlayer_(float aspect, ControlSystem& sys) {
 	player_cam.forward = lm::vec3(0.0f, 0.0f, -1.0f);
 	player_cam.setPerspective(60.0f*DEG2RAD, aspect, 0.01f, 10000.0f);
 
-	//FPS colliders 
-	//each collider ray entity is parented to the playerFPS entity
-	int ent_down_ray = ECS.createEntity("Down Ray");
-	Transform& down_ray_trans = ECS.getComponentFromEntity<Transform>(ent_down_ray);
-	down_ray_trans.parent = ECS.getComponentID<Transform>(ent_player); //set parent as player entity *transform*!
-	Collider& down_ray_collider = ECS.createComponentForEntity<Collider>(ent_down_ray);
-	down_ray_collider.collider_type = ColliderTypeRay;
-	down_ray_collider.direction = lm::vec3(0.0, -1.0, 0.0);
-	down_ray_collider.max_distance = 100.0f;
-
-	int ent_left_ray = ECS.createEntity("Left Ray");
-	Transform& left_ray_trans = ECS.getComponentFromEntity<Transform>(ent_left_ray);
-	left_ray_trans.parent = ECS.getComponentID<Transform>(ent_player); //set parent as player entity *transform*!
-	Collider& left_ray_collider = ECS.createComponentForEntity<Collider>(ent_left_ray);
-	left_ray_collider.collider_type = ColliderTypeRay;
-	left_ray_collider.direction = lm::vec3(-1.0, 0.0, 0.0);
-	left_ray_collider.max_distance = 1.0f;
-
-	int ent_right_ray = ECS.createEntity("Right Ray");
-	Transform& right_ray_trans = ECS.getComponentFromEntity<Transform>(ent_right_ray);
-	right_ray_trans.parent = ECS.getComponentID<Transform>(ent_player); //set parent as player entity *transform*!
-	Collider& right_ray_collider = ECS.createComponentForEntity<Collider>(ent_right_ray);
-	right_ray_collider.collider_type = ColliderTypeRay;
-	right_ray_collider.direction = lm::vec3(1.0, 0.0, 0.0);
-	right_ray_collider.max_distance = 1.0f;
-
-	int ent_forward_ray = ECS.createEntity("Forward Ray");
-	Transform& forward_ray_trans = ECS.getComponentFromEntity<Transform>(ent_forward_ray);
-	forward_ray_trans.parent = ECS.getComponentID<Transform>(ent_player); //set parent as player entity *transform*!
-	Collider& forward_ray_collider = ECS.createComponentForEntity<Collider>(ent_forward_ray);
-	forward_ray_collider.collider_type = ColliderTypeRay;
-	forward_ray_collider.direction = lm::vec3(0.0, 0.0, -1.0);
-	forward_ray_collider.max_distance = 1.0f;
-
-	int ent_back_ray = ECS.createEntity("Back Ray");
-	Transform& back_ray_trans = ECS.getComponentFromEntity<Transform>(ent_back_ray);
-	back_ray_trans.parent = ECS.getComponentID<Transform>(ent_player); //set parent as player entity *transform*!
-	Collider& back_ray_collider = ECS.createComponentForEntity<Collider>(ent_back_ray);
-	back_ray_collider.collider_type = ColliderTypeRay;
-	back_ray_collider.direction = lm::vec3(0.0, 0.0, 1.0);
-	back_ray_collider.max_distance = 1.0f;
-
-	//the control system stores the FPS colliders 
-	sys.FPS_collider_down = ECS.getComponentID<Collider>(ent_down_ray);
-	sys.FPS_collider_left = ECS.getComponentID<Collider>(ent_left_ray);
-	sys.FPS_collider_right = ECS.getComponentID<Collider>(ent_right_ray);
-	sys.FPS_collider_forward = ECS.getComponentID<Collider>(ent_forward_ray);
-	sys.FPS_collider_back = ECS.getComponentID<Collider>(ent_back_ray);
+	//FPS collisions come from rays the control system casts from the player
+	//each frame, see ControlSystem::updateFPS
 
 	ECS.main_camera = ECS.getComponentID<Camera>(ent_player);
 
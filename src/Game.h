@@ -12,6 +12,7 @@
 #include "CollisionSystem.h"
 #include "ScriptSystem.h"
 #include "GUISystem.h"
+#include "Scheduler.h"
 
 
 
@@ -56,6 +57,10 @@ private:
     ScriptSystem script_system_;
 	GUISystem gui_system_;
 
+	//frame scheduling, on the global JOBS pool
+	Scheduler scheduler_;
+	void scheduleSystems_();
+
 	int createFreeCamera_();
 	int createPlayer_(float aspect, ControlSystem& sys);
 
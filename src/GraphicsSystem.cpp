@@ -31,64 +31,326 @@ void GraphicsSystem::init(int window_width, int window_height, std::string asset
     glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
     
     assets_folder_ = assets_folder;
+
+    //uniform buffers shared by all shaders
+    createUniformBuffers_();
+
+	occlusion_buffer_.init(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+
+	//instance buffer is created up front so the geometry arena vao can point at it
+	glGenBuffers(1, &instance_vbo_);
+
+	//arena geometries are drawn with glMultiDrawElementsIndirect where available
+	multi_draw_indirect_ = GLEW_VERSION_4_3 != 0;
+	if (multi_draw_indirect_) glGenBuffers(1, &indirect_buffer_);
     
 }
 
 //called after loading everything
 void GraphicsSystem::lateInit() {
-    sortMeshes_();
+	//transforms follow mesh order, so culling reads both arrays in sequence
+	ECS.packComponents<Mesh, Transform>();
 }
 
 void GraphicsSystem::update(float dt) {
+	prepareFrame(dt);
+	renderFrame();
+}
+
+//CPU side of the frame: cameras, frame uniform data, culling and batching.
+//Makes no GL calls, so it may run on a worker thread
+void GraphicsSystem::prepareFrame(float dt) {
+
+	updateAllCameras_();
+
+	fillFrameUniformData_();
+
+	//planes are extracted once for the main camera, and shared by every mesh
+	Camera& cam = ECS.getComponentInArray<Camera>(ECS.main_camera);
+	frustum_.extract(cam.view_projection);
+
+	//refresh world bounds of meshes which moved, in parallel. Each chunk
+	//lists the meshes it moved in its own slot of moved_meshes_
+	auto& meshes = ECS.getAllComponents<Mesh>();
+	size_t num_meshes = meshes.size();
+	mesh_transforms_.resize(num_meshes);
+	cull_bounds_.resize(num_meshes);
+	moved_meshes_.resize((num_meshes + CULL_CHUNK - 1) / CULL_CHUNK);
+	updateRenderTree_();
+	JOBS.parallelFor(num_meshes, CULL_CHUNK, [this, &meshes](size_t begin, size_t end) {
+		std::vector<int>& moved = moved_meshes_[begin / CULL_CHUNK];
+		moved.clear();
+		for (size_t i = begin; i < end; i++) {
+			int transform_id = ECS.getComponentID<Transform>(meshes[i].owner);
+			mesh_transforms_[i] = transform_id;
+			if (updateMeshBounds_(meshes[i], i, transform_id)) moved.push_back((int)i);
+		}
+	});
+	//tree isn't thread safe, so only the leaves of moved meshes are refit afterwards
+	for (auto& moved : moved_meshes_) {
+		for (int mesh_id : moved) {
+			MeshBounds& bounds = mesh_bounds_[mesh_id];
+			AABB& b = bounds.world;
+			render_tree_.move(bounds.proxy, b.center - b.half_width, b.center + b.half_width);
+		}
+	}
+
+	//walk the tree. Subtrees inside the frustum are visible without further
+	//tests, and meshes in leaves crossing it are tested four at a time
+	visible_meshes_.clear();
+	cull_candidates_.clear();
+	const Frustum& frustum = frustum_;
+	render_tree_.traverse(
+		[&frustum](const lm::vec3& min, const lm::vec3& max) { return frustum.classify(min, max); },
+		[this](int mesh_id, bool inside) { (inside ? visible_meshes_ : cull_candidates_).push_back(mesh_id); });
+	candidate_visible_.resize(cull_candidates_.size());
+	cullAABBs(frustum_, cull_bounds_, cull_candidates_.data(), cull_candidates_.size(), candidate_visible_.data());
+	for (size_t i = 0; i < cull_candidates_.size(); i++) {
+		if (candidate_visible_[i]) visible_meshes_.push_back(cull_candidates_[i]);
+	}
+
+	if (use_occlusion_culling_) cullOccluded_();
+
+	fillRenderQueue_();
+
+	//gather visible ones into instance batches, in queue order, noting where
+	//the transparent pass starts
+	instances_.clear();
+	batches_.clear();
+	first_transparent_batch_ = -1;
+	for (auto& entry : render_queue_.entries) {
+		if (first_transparent_batch_ == -1 && RenderQueue::getPass(entry.key) == RenderPassTransparent)
+			first_transparent_batch_ = (int)batches_.size();
+		addMeshInstance_(meshes[entry.mesh], mesh_transforms_[entry.mesh]);
+	}
+	if (first_transparent_batch_ == -1) first_transparent_batch_ = (int)batches_.size();
+}
+
+//builds a sort key for each visible mesh and sorts them. Depth is the
+//distance along the view direction to the center of the mesh's cached world
+//bounds, scaled from 0 to 1 by the furthest visible mesh
+void GraphicsSystem::fillRenderQueue_() {
+	auto& meshes = ECS.getAllComponents<Mesh>();
+	Camera& cam = ECS.getComponentInArray<Camera>(ECS.main_camera);
+	size_t num_visible = visible_meshes_.size();
+	visible_depths_.resize(num_visible);
+	render_queue_.entries.resize(num_visible);
+	JOBS.parallelFor(num_visible, CULL_CHUNK, [this, &cam](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			float depth = (mesh_bounds_[visible_meshes_[i]].world.center - cam.position).dot(cam.forward);
+			visible_depths_[i] = depth > 0.0f ? depth : 0.0f;
+		}
+	});
+	float max_depth = 0.0f;
+	for (float depth : visible_depths_) {
+		if (depth > max_depth) max_depth = depth;
+	}
+	float inv_max_depth = max_depth > 0.0f ? 1.0f / max_depth : 0.0f;
+
+	JOBS.parallelFor(num_visible, CULL_CHUNK, [this, &meshes, inv_max_depth](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			int mesh_id = visible_meshes_[i];
+			const Mesh& mesh = meshes[mesh_id];
+			const Material& mat = materials_[mesh.material];
+			float depth = visible_depths_[i] * inv_max_depth;
+			render_queue_.entries[i].key = mat.isTransparent() ?
+				RenderQueue::makeTransparentKey(mesh.material, mesh.geometry, depth) :
+				RenderQueue::makeOpaqueKey(mat.shader_id, mesh.material, mesh.geometry, depth);
+			render_queue_.entries[i].mesh = mesh_id;
+		}
+	});
+	render_queue_.sort();
+}
+
+//GL side of the frame: uploads what prepareFrame gathered and draws it.
+//Must run on the thread which owns the GL context
+void GraphicsSystem::renderFrame() {
     
 	bindAndClearScreen_();
     
 	resetShaderAndMaterial_();
+
+	updateFrameUniformBuffer_();
+
+	updateMaterialUniformBuffer_();
+
+	uploadInstances_();
+
+	//send geometry added to the arena since the last frame
+	if (geometry_arena_.dirty) geometry_arena_.upload(instance_vbo_);
+
+	if (multi_draw_indirect_) uploadIndirectCommands_();
+
+	//opaque pass, near meshes first
+	renderBatches_(0, first_transparent_batch_);
     
-	updateAllCameras_();
-    
-    for (auto &mesh : ECS.getAllComponents<Mesh>()) {
-        renderMeshComponent_(mesh);
-    }
-    
+	//environment fills only pixels left at the far plane
     renderEnvironment_();
+
+	//transparent pass, back to front. Blended meshes don't write depth, so
+	//they don't hide the ones behind them
+	if (first_transparent_batch_ < (int)batches_.size()) {
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		glDepthMask(GL_FALSE);
+		renderBatches_(first_transparent_batch_, (int)batches_.size());
+		glDepthMask(GL_TRUE);
+		glDisable(GL_BLEND);
+	}
     
 }
 
-//renders a given mesh component
-void GraphicsSystem::renderMeshComponent_(Mesh& comp) {
-	
-	//change shader and mesh if required
-	checkShaderAndMaterial(comp);
+//recalculates world bounds of mesh if its geometry or world matrix changed,
+//or if another mesh now occupies its slot in the array. Returns true if they
+//were recalculated, so the mesh's leaf needs moving
+bool GraphicsSystem::updateMeshBounds_(const Mesh& mesh, size_t mesh_id, int transform_id) {
+	MeshBounds& bounds = mesh_bounds_[mesh_id];
+	unsigned int world_version = ECS.world_versions[transform_id];
+	if (bounds.transform_id == transform_id && bounds.geometry == mesh.geometry && bounds.world_version == world_version)
+		return false;
+	bounds.transform_id = transform_id;
+	bounds.geometry = mesh.geometry;
+	bounds.world_version = world_version;
+	bounds.world = transformAABB_(geometries_[mesh.geometry].aabb, ECS.getWorldMatrix(transform_id));
+	cull_bounds_.set(mesh_id, bounds.world);
+	return true;
+}
 
-	//get components and geom
-	Transform& transform = ECS.getComponentFromEntity<Transform>(comp.owner);
+//draws the occluders which survived the frustum cull into the occlusion
+//buffer, then removes visible meshes whose bounds are hidden behind them.
+//Occluders are always kept, and the list stays in mesh order
+void GraphicsSystem::cullOccluded_() {
+	auto& meshes = ECS.getAllComponents<Mesh>();
 	Camera& cam = ECS.getComponentInArray<Camera>(ECS.main_camera);
-	Geometry& geom = geometries_[comp.geometry];
+	occlusion_buffer_.clear(cam.view_projection);
+	bool any_occluders = false;
+	for (int i : visible_meshes_) {
+		if (!meshes[i].occluder || materials_[meshes[i].material].isTransparent()) continue;
+		if (!prepareOccluder(meshes[i].geometry)) continue;
+		occlusion_buffer_.drawOccluder(occluder_meshes_[meshes[i].geometry], ECS.getWorldMatrix(mesh_transforms_[i]));
+		any_occluders = true;
+	}
+	if (!any_occluders) return;
+	occlusion_buffer_.buildHiZ();
+
+	occlusion_visible_.resize(visible_meshes_.size());
+	JOBS.parallelFor(visible_meshes_.size(), CULL_CHUNK, [this, &meshes](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			int mesh_id = visible_meshes_[i];
+			const AABB& b = mesh_bounds_[mesh_id].world;
+			occlusion_visible_[i] = (meshes[mesh_id].occluder && !materials_[meshes[mesh_id].material].isTransparent()) ||
+				occlusion_buffer_.testAABB(b.center - b.half_width, b.center + b.half_width);
+		}
+	});
+	size_t num_visible = 0;
+	for (size_t i = 0; i < visible_meshes_.size(); i++) {
+		if (occlusion_visible_[i]) visible_meshes_[num_visible++] = visible_meshes_[i];
+	}
+	visible_meshes_.resize(num_visible);
+}
 
-	//create mvp
-	lm::mat4 model_matrix = transform.getGlobalMatrix(ECS.getAllComponents<Transform>());
-	lm::mat4 mvp_matrix = cam.view_projection * model_matrix;
+//gives each slot of the mesh array a leaf in the render tree, and removes
+//the leaves of slots past its end. New leaves start as a point, and get
+//their real bounds from updateMeshBounds_
+void GraphicsSystem::updateRenderTree_() {
+	size_t num_meshes = ECS.getAllComponents<Mesh>().size();
+	for (size_t i = num_meshes; i < mesh_bounds_.size(); i++)
+		render_tree_.remove(mesh_bounds_[i].proxy);
+	size_t old_size = mesh_bounds_.size();
+	mesh_bounds_.resize(num_meshes);
+	for (size_t i = old_size; i < num_meshes; i++)
+		mesh_bounds_[i].proxy = render_tree_.insert(lm::vec3(), lm::vec3(), (int)i);
+}
 
-	//view frustum culling
-	if (!BBInFrustum_(geom.aabb, mvp_matrix)) {
-		return;
+//adds a visible mesh component as an instance. Meshes come in render queue
+//order, so a mesh with the same geometry and material as the last batch is appended
+//to that batch, otherwise it starts a new one
+void GraphicsSystem::addMeshInstance_(Mesh& comp, int transform_id) {
+
+	//normal matrix is only recalculated by the ECS when the transform changes
+	InstanceData instance;
+	instance.model = ECS.getWorldMatrix(transform_id);
+	instance.normal_matrix = ECS.getNormalMatrix(transform_id);
+	instances_.push_back(instance);
+
+	if (batches_.empty() || batches_.back().geometry != comp.geometry || batches_.back().material != comp.material) {
+		InstanceBatch batch;
+		batch.geometry = comp.geometry;
+		batch.material = comp.material;
+		batch.first_instance = (int)instances_.size() - 1;
+		batch.num_instances = 0;
+		batches_.push_back(batch);
 	}
+	batches_.back().num_instances++;
+}
 
-	//normal matrix
-	lm::mat4 normal_matrix = model_matrix;
-	normal_matrix.inverse();
-	normal_matrix.transpose();
+//uploads this frame's instances in one go. The buffer only grows, and is
+//orphaned each frame so we don't wait for the previous frame's draws
+void GraphicsSystem::uploadInstances_() {
+	if (instances_.empty()) return;
+
+	glBindBuffer(GL_ARRAY_BUFFER, instance_vbo_);
+	if (instances_.size() > instance_vbo_capacity_)
+		instance_vbo_capacity_ = instances_.size() * 2;
+	glBufferData(GL_ARRAY_BUFFER, instance_vbo_capacity_ * sizeof(InstanceData), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, instances_.size() * sizeof(InstanceData), &(instances_[0]));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+//builds one indirect command per batch of arena geometry, in batch order, and
+//uploads them in one go
+void GraphicsSystem::uploadIndirectCommands_() {
+	indirect_commands_.clear();
+	for (auto& batch : batches_) {
+		Geometry& geom = geometries_[batch.geometry];
+		if (!geom.in_arena) continue;
+		DrawElementsIndirectCommand command;
+		command.count = geom.num_tris * 3;
+		command.instance_count = batch.num_instances;
+		command.first_index = geom.first_index;
+		command.base_vertex = geom.base_vertex;
+		command.base_instance = batch.first_instance;
+		indirect_commands_.push_back(command);
+	}
+	if (indirect_commands_.empty()) return;
 
-	//transform uniforms
-	shader_->setUniform(U_MVP, mvp_matrix);
-	shader_->setUniform(U_MODEL, model_matrix);
-	shader_->setUniform(U_NORMAL_MATRIX, normal_matrix);
-	shader_->setUniform(U_CAM_POS, cam.position);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer_);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, indirect_commands_.size() * sizeof(DrawElementsIndirectCommand), &(indirect_commands_[0]), GL_STREAM_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
 
-	//draw
-	geom.render();
+//draws batches first to last with one instanced draw call each. With multi-draw
+//indirect, consecutive arena batches sharing a material are drawn together with
+//a single call
+void GraphicsSystem::renderBatches_(int first, int last) {
+	//commands were built for every arena batch, so skip those of earlier batches
+	size_t command = 0;
+	for (int b = 0; b < first; b++) {
+		if (geometries_[batches_[b].geometry].in_arena) command++;
+	}
 
+	size_t i = first;
+	while (i < (size_t)last) {
+		InstanceBatch& batch = batches_[i];
+		//change shader and material if required
+		checkShaderAndMaterial(batch.material);
+
+		Geometry& geom = geometries_[batch.geometry];
+		if (!multi_draw_indirect_ || !geom.in_arena) {
+			geom.renderInstanced(instance_vbo_, batch.first_instance, batch.num_instances);
+			i++;
+			continue;
+		}
+
+		//commands were built in batch order, so the run is contiguous
+		int material = batch.material;
+		size_t first_command = command;
+		while (i < (size_t)last && batches_[i].material == material && geometries_[batches_[i].geometry].in_arena) {
+			i++;
+			command++;
+		}
+		geometry_arena_.renderIndirect(indirect_buffer_, first_command, command - first_command);
+	}
 }
 
 //render the skybox as a cubemap
@@ -131,159 +393,117 @@ void GraphicsSystem::renderEnvironment_() {
 }
 
 //checks to see if current shader and material are
-//the ones need for mesh passed as parameter
+//the ones needed for material passed as parameter
 //if not, change them
-void GraphicsSystem::checkShaderAndMaterial(Mesh& mesh) {
+void GraphicsSystem::checkShaderAndMaterial(int material) {
     //get shader id from material. if same, don't change
-    if (!shader_ || shader_->program != materials_[mesh.material].shader_id) {
-		useShader(materials_[mesh.material].shader_id);
+    if (!shader_ || shader_->program != materials_[material].shader_id) {
+		useShader(materials_[material].shader_id);
     }
     //set material uniforms if required
-    if (current_material_ != mesh.material) {
-        current_material_ = mesh.material;
+    if (current_material_ != material) {
+        current_material_ = material;
         setMaterialUniforms();
     }
 }
 
 //sets uniforms for current material and current shader
+//material parameters are already in the material uniform buffer, so we only
+//bind its range for this material, plus any textures
 void GraphicsSystem::setMaterialUniforms() {
     Material& mat = materials_[current_material_];
-    
-	//temporary stuff for UBO_test
-
-	GLint u_color_a = glGetUniformLocation(shader_->program, "u_test_struct.color_a"); 
-	if (u_color_a != -1) glUniform3f(u_color_a, 1.0, 0.0, 1.0);
 
-	GLint u_color_b = glGetUniformLocation(shader_->program, "u_test_struct.color_b");
-	if (u_color_b != -1) glUniform3f(u_color_b, 0.0, 1.0, 0.0);
-
-	
-    //material uniforms
-	shader_->setUniform(U_AMBIENT, mat.ambient);
-	shader_->setUniform(U_DIFFUSE, mat.diffuse);
-	shader_->setUniform(U_SPECULAR, mat.specular);
-	shader_->setUniform(U_SPECULAR_GLOSS, mat.specular_gloss);
+	glBindBufferRange(GL_UNIFORM_BUFFER, UB_MATERIAL, material_ubo_,
+		current_material_ * material_ubo_stride_, sizeof(MaterialUniformData));
     
     //texture uniforms
     if (mat.diffuse_map != -1){
-        shader_->setUniform(U_USE_DIFFUSE_MAP, 1);
         shader_->setTexture(U_DIFFUSE_MAP, mat.diffuse_map, 0);
     }
 
     //reflection
-    if (mat.cube_map) {
-        shader_->setUniform(U_USE_REFLECTION_MAP, 1);
+    if (mat.cube_map != -1) {
         shader_->setTextureCube(U_SKYBOX, mat.cube_map, 1);
-        
-    }
-    
-    //light uniforms
-    const std::vector<Light>& lights = ECS.getAllComponents<Light>();  // get number of lights in scene from ECM
-    
-    GLint u_num_lights = glGetUniformLocation(shader_->program, "u_num_lights"); //get/set uniform in shader
-    if (u_num_lights != -1) glUniform1i(u_num_lights, (int)lights.size());
-    
-    //for each light
-    for (size_t i = 0; i < lights.size(); i++) {
-        //get light transform
-        Transform& light_transform = ECS.getComponentFromEntity<Transform>(lights[i].owner);
-        
-        //position
-        std::string light_position_name = "lights[" + std::to_string(i) + "].position"; // create dynamic uniform name
-        GLint u_light_pos = glGetUniformLocation(shader_->program, light_position_name.c_str()); //find it
-        if (u_light_pos != -1) glUniform3fv(u_light_pos, 1, light_transform.position().value_); // light position
-        
-        //color
-        std::string light_color_name = "lights[" + std::to_string(i) + "].color";
-        GLint u_light_col = glGetUniformLocation(shader_->program, light_color_name.c_str());
-        if (u_light_col != -1) glUniform3fv(u_light_col, 1, lights[i].color.value_);
-        
-        //direction
-        std::string light_direction_name = "lights[" + std::to_string(i) + "].direction";
-        GLint u_light_dir = glGetUniformLocation(shader_->program, light_direction_name.c_str());
-        glUniform3fv(u_light_dir, 1, lights[i].direction.value_);
-        
-        //type
-        std::string light_type_name = "lights[" + std::to_string(i) + "].type";
-        GLint u_light_type = glGetUniformLocation(shader_->program, light_type_name.c_str());
-        glUniform1i(u_light_type, lights[i].type);
-        
-        //linear att
-        std::string light_latt_name = "lights[" + std::to_string(i) + "].linear_att";
-        GLint u_light_latt = glGetUniformLocation(shader_->program, light_latt_name.c_str());
-        glUniform1f(u_light_latt, lights[i].linear_att);
-        
-        //quadratic att
-        std::string light_qatt_name = "lights[" + std::to_string(i) + "].quadratic_att";
-        GLint u_light_qatt = glGetUniformLocation(shader_->program, light_qatt_name.c_str());
-        glUniform1f(u_light_qatt, lights[i].quadratic_att);
-
-		//spotcone cutoff
-		std::string light_innercone_name = "lights[" + std::to_string(i) + "].spot_inner_cosine";
-		GLint u_light_innercone = glGetUniformLocation(shader_->program, light_innercone_name.c_str());
-		glUniform1f(u_light_innercone, cos (lights[i].spot_inner*DEG2RAD / 2));
-
-		//spotcone cutoff outer
-		std::string light_outercone_name = "lights[" + std::to_string(i) + "].spot_outer_cosine";
-		GLint u_light_outercone = glGetUniformLocation(shader_->program, light_outercone_name.c_str());
-		glUniform1f(u_light_outercone, cos(lights[i].spot_outer *DEG2RAD / 2));
-
     }
 }
 
-//This function executes two sorts:
-// i) sorts materials array by shader_id
-// ii) sorts Mesh components by material id
-//the result is that the mesh component array is
-//ordered by both shader and material
-void GraphicsSystem::sortMeshes_() {
-
-	//sort materials by shader id
-	//first we store the old index of each material in materials_ array
-	for (size_t i = 0; i < materials_.size(); i++)
-		materials_[i].index = (int)i; // 'index' is a new property of Material
+//creates the uniform buffers for the FrameData and MaterialData blocks. Shaders bind
+//their blocks to the binding points with the same UniformBlockID when linked
+void GraphicsSystem::createUniformBuffers_() {
+	glGenBuffers(1, &frame_ubo_);
+	glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo_);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniformData), NULL, GL_DYNAMIC_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, UB_FRAME, frame_ubo_);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	//material blocks are bound with glBindBufferRange, so each one must start
+	//at a multiple of the offset alignment
+	GLint alignment = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	GLint block_size = (GLint)sizeof(MaterialUniformData);
+	material_ubo_stride_ = ((block_size + alignment - 1) / alignment) * alignment;
+	glGenBuffers(1, &material_ubo_);
+}
 
-	//second, we sort materials by shader_id
-	std::sort(materials_.begin(), materials_.end(), [](const Material& a, const Material& b) {
-		return a.shader_id < b.shader_id;
+//fills CPU copy of FrameData with the main camera and all lights
+void GraphicsSystem::fillFrameUniformData_() {
+	Camera& cam = ECS.getComponentInArray<Camera>(ECS.main_camera);
+	frame_data_.view = cam.view_matrix;
+	frame_data_.projection = cam.projection_matrix;
+	frame_data_.cam_pos = cam.position;
+
+	//lights beyond MAX_LIGHTS are ignored
+	int num_lights = 0;
+	ECS.view<Light, Transform>().each([this, &num_lights](Light& light, Transform& transform) {
+		if (num_lights == MAX_LIGHTS) return;
+		LightUniformData& ld = frame_data_.lights[num_lights++];
+		ld.position = ECS.getWorldMatrix(transform).position();
+		ld.direction = light.direction;
+		ld.color = light.color;
+		ld.type = light.type;
+		ld.linear_att = light.linear_att;
+		ld.quadratic_att = light.quadratic_att;
+		ld.spot_inner_cosine = cos(light.spot_inner * DEG2RAD / 2);
+		ld.spot_outer_cosine = cos(light.spot_outer * DEG2RAD / 2);
 	});
+	frame_data_.num_lights = num_lights;
+}
 
-	//now we map old indices to new indices
-	std::map<int, int> old_new;
-	for (size_t i = 0; i < materials_.size(); i++) {
-		old_new[materials_[i].index] = (int)i;
-	}
-
-	//now we swap index of materials in all meshes
-	auto& meshes = ECS.getAllComponents<Mesh>();
-	for (auto& mesh : meshes) {
-		int old_index = mesh.material;
-		int new_index = old_new[old_index];
-		mesh.material = new_index;
-	}
-
-	//store old mesh indices
-	for (size_t i = 0; i < meshes.size(); i++)
-		meshes[i].index = (int)i;
+//uploads FrameData once for all shaders and materials drawn this frame
+void GraphicsSystem::updateFrameUniformBuffer_() {
+	glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo_);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniformData), &frame_data_);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
 
-	//short meshes by material id
-	std::sort(meshes.begin(), meshes.end(), [](const Mesh& a, const Mesh& b) {
-		return a.material < b.material;
-	});
+//uploads MaterialData of every material modified since last upload. If new
+//materials were created, the buffer is reallocated and every material uploaded
+void GraphicsSystem::updateMaterialUniformBuffer_() {
+	glBindBuffer(GL_UNIFORM_BUFFER, material_ubo_);
 
-	//clear map and refill with mesh index map
-	old_new.clear();
-	for (size_t i = 0; i < meshes.size(); i++) {
-		old_new[meshes[i].index] = (int)i;
+	if (materials_.size() > material_ubo_capacity_) {
+		material_ubo_capacity_ = materials_.size();
+		glBufferData(GL_UNIFORM_BUFFER, material_ubo_capacity_ * material_ubo_stride_, NULL, GL_DYNAMIC_DRAW);
+		for (auto& mat : materials_) mat.dirty = true;
 	}
 
-	//update all entities with new mesh id
-	auto& all_entities = ECS.entities;
-	for (auto& ent : ECS.entities) {
-		int old_index = ent.components[type2int<Mesh>::result];
-		int new_index = old_new[old_index];
-		ent.components[type2int<Mesh>::result] = new_index;
+	for (size_t i = 0; i < materials_.size(); i++) {
+		Material& mat = materials_[i];
+		if (!mat.dirty) continue;
+
+		MaterialUniformData data;
+		data.ambient = mat.ambient;
+		data.diffuse = mat.diffuse;
+		data.specular = mat.specular;
+		data.specular_gloss = mat.specular_gloss;
+		data.use_diffuse_map = mat.diffuse_map != -1 ? 1 : 0;
+		data.use_reflection_map = mat.cube_map != -1 ? 1 : 0;
+		data.opacity = mat.opacity;
+		glBufferSubData(GL_UNIFORM_BUFFER, i * material_ubo_stride_, sizeof(MaterialUniformData), &data);
+		mat.dirty = false;
 	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
 
 //reset shader and material
@@ -296,8 +516,9 @@ void GraphicsSystem::resetShaderAndMaterial_() {
 //update cameras
 void GraphicsSystem::updateAllCameras_() {
 
-	auto& cameras = ECS.getAllComponents<Camera>();
-	for (auto &cam : cameras) cam.update();
+	JOBS.parallelFor(ECS.getAllComponents<Camera>(), CAMERA_CHUNK, [](Camera& cam, size_t) {
+		cam.update();
+	});
 }
 
 void GraphicsSystem::bindAndClearScreen_() {
@@ -388,9 +609,14 @@ int GraphicsSystem::createGeometryFromFile(std::string filename) {
         //fill it with data from object
         if (Parsers::parseOBJ(filename, vertices, uvs, normals, indices)) {
             
-            //generate the OpenGL buffers and create geometry
-			Geometry new_geom(vertices, uvs, normals, indices);
+            //generate the OpenGL buffers and create geometry, or sub-allocate it in the arena
+			Geometry new_geom;
+			if (use_geometry_arena_)
+				geometry_arena_.addGeometry(new_geom, vertices, uvs, normals, indices);
+			else
+				new_geom.createVertexArrays(vertices, uvs, normals, indices);
             geometries_.emplace_back(new_geom);
+			geometry_files_[(int)geometries_.size() - 1] = filename;
 
             return (int)geometries_.size() - 1;
         }
@@ -406,6 +632,29 @@ int GraphicsSystem::createGeometryFromFile(std::string filename) {
     
 }
 
+// Loads the triangles of a geometry again from its file, as vec4 points ready
+// for the occlusion buffer. Tried once per geometry, a failure is remembered
+// as an empty mesh
+bool GraphicsSystem::prepareOccluder(int geom_id) {
+	auto found = occluder_meshes_.find(geom_id);
+	if (found != occluder_meshes_.end()) return !found->second.indices.empty();
+
+	OccluderMesh& occluder = occluder_meshes_[geom_id];
+	auto file = geometry_files_.find(geom_id);
+	if (file == geometry_files_.end()) return false;
+	std::vector<GLfloat> vertices, uvs, normals;
+	std::vector<GLuint> indices;
+	if (!Parsers::parseOBJ(file->second, vertices, uvs, normals, indices)) {
+		std::cerr << "ERROR: Could not parse mesh file for occluder" << std::endl;
+		return false;
+	}
+	occluder.vertices.reserve(vertices.size() / 3);
+	for (size_t i = 0; i + 2 < vertices.size(); i += 3)
+		occluder.vertices.push_back(lm::vec4(vertices[i], vertices[i + 1], vertices[i + 2], 1.0f));
+	occluder.indices = indices;
+	return !occluder.indices.empty();
+}
+
 // Given an array of floats (in sets of three, representing vertices) calculates and
 // sets the AABB of a geometry
 void GraphicsSystem::setGeometryAABB_(Geometry& geom, std::vector<GLfloat>& vertices) {
@@ -440,206 +689,20 @@ void GraphicsSystem::setGeometryAABB_(Geometry& geom, std::vector<GLfloat>& vert
 		max.z - geom.aabb.center.z);
 }
 
-//relcalculates AABB from OOB
+//world space AABB of a local AABB under transform. The new center is the
+//transformed center, and each new half width is the sum of the local half
+//widths scaled by the absolute values of the matrix row, which bounds every
+//corner of the box however it is rotated
 AABB GraphicsSystem::transformAABB_(const AABB& aabb, const lm::mat4& transform) {
-	//get aabb min and max
-	lm::vec3 aabb_min(
-		aabb.center.x - aabb.half_width.x,
-		aabb.center.y - aabb.half_width.y,
-		aabb.center.z - aabb.half_width.z);
-	lm::vec3 aabb_max(
-		aabb.center.x + aabb.half_width.x,
-		aabb.center.y + aabb.half_width.y,
-		aabb.center.z + aabb.half_width.z);
-
-	//transform min and max
-	lm::vec3 min_t = transform * aabb_min;
-	lm::vec3 max_t = transform * aabb_max;
-
-	//create array of coords for easier parsing
-	float vertices[6] = { min_t.x, min_t.y, min_t.z, max_t.x, max_t.y, max_t.z };
-
-	//set very max and very min
-	float big = 1000000.0f;
-	float small = -1000000.0f;
-	lm::vec3 min(big, big, big);
-	lm::vec3 max(small, small, small);
-
-	//calculate new aabb based on transformed verts
-	for (int i = 0; i < 6; i += 3) {
-		float x = vertices[i];
-		float y = vertices[i + 1];
-		float z = vertices[i + 2];
-
-		if (x < min.x) min.x = x;
-		if (y < min.y) min.y = y;
-		if (z < min.z) min.z = z;
-
-		if (x > max.x) max.x = x;
-		if (y > max.y) max.y = y;
-		if (z > max.z) max.z = z;
-	}
-
 	AABB new_aabb;
-	//set new center and halfwidth based on max and min
-	new_aabb.center = lm::vec3(
-		(min.x + max.x) / 2,
-		(min.y + max.y) / 2,
-		(min.z + max.z) / 2);
-	new_aabb.half_width = lm::vec3(
-		max.x - new_aabb.center.x,
-		max.y - new_aabb.center.y,
-		max.z - new_aabb.center.z);
-
-	return new_aabb;
-}
-
-
-//tests whether AABB or OOB is inside frustum or not, based on view_projection matrix
-bool GraphicsSystem::AABBInFrustum_(const AABB& aabb, const lm::mat4& to_clip) {
-	lm::vec4 points[8];
-	points[0] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
-	points[1] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
-	points[2] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
-	points[3] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
-	points[4] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
-	points[5] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
-	points[6] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
-	points[7] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
-
-	//transform to clip space
-	lm::vec4 clip_points[8];
-	for (int i = 0; i < 8; i++) {
-		clip_points[i] = to_clip * points[i];
-	}
-
-	//now test clip points against each plane. If all clip points are outside plane we return false
-	//left plane
-	int in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (-clip_points[i].w < clip_points[i].x) in++;
-	}
-	if (!in) return false;
-
-	//right plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (clip_points[i].x < clip_points[i].w) in++;
-	}
-	if (!in) return false;
-
-	//bottom plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (-clip_points[i].w < clip_points[i].y) in++;
-	}
-	if (!in) return false;
-
-	//top plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (clip_points[i].y < clip_points[i].w) in++;
-	}
-	if (!in) return false;
-
-	//near plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (-clip_points[i].z < clip_points[i].z) in++;
+	new_aabb.center = transform * aabb.center;
+	for (int r = 0; r < 3; r++) {
+		new_aabb.half_width.value_[r] =
+			fabs(transform.m[r]) * aabb.half_width.x +
+			fabs(transform.m[4 + r]) * aabb.half_width.y +
+			fabs(transform.m[8 + r]) * aabb.half_width.z;
 	}
-	if (!in) return false;
-
-	//far plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (clip_points[i].z < clip_points[i].w) in++;
-	}
-	if (!in) return false;
-
-	return true;
-}
-
-//tests whether Bounding box is inside frustum or not, based on model_view_projection matrix
-bool GraphicsSystem::BBInFrustum_(const AABB& aabb, const lm::mat4& mvp) {
-    //each corner point of box gets transformed into clip space, to give point PC, in HOMOGENOUS coords
-    //point is inside clip space iff
-    //-PC.w < PC.xyz < PC.w
-    //so we first take each corner of AABB (note, using vec4 because of homogenous coords) and multiply
-    //by matrix to clip space. Then we test each point against the 6 planes e.g. PC is on the 'right' side
-    //of the left plane iff -PC.w < PC.x; and is on 'left' side of right plane is PC.x < PC.w etc.
-    //For more info see:
-    //http://www.lighthouse3d.com/tutorials/view-frustum-culling/clip-space-approach-extracting-the-planes/
-    
-    
-    //the eight points of the box corners are calculated using center and +/- halfwith:
-    //- - -
-    //- - +
-    //- + -
-    //- + +
-    //+ - -
-    //+ - +
-    //+ + -
-    //+ + +
-	lm::vec4 points[8];
-	points[0] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
-	points[1] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
-	points[2] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
-	points[3] = lm::vec4(aabb.center.x - aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
-	points[4] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
-	points[5] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y - aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
-	points[6] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z - aabb.half_width.z, 1.0);
-	points[7] = lm::vec4(aabb.center.x + aabb.half_width.x, aabb.center.y + aabb.half_width.y, aabb.center.z + aabb.half_width.z, 1.0);
-
-	//transform to clip space
-	lm::vec4 clip_points[8];
-	for (int i = 0; i < 8; i++) {
-		clip_points[i] = mvp * points[i];
-	}
-
-	//now test clip points against each plane. If all clip points are outside plane we return false
-	//left plane
-	int in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (-clip_points[i].w < clip_points[i].x) in++;
-	}
-	if (!in) return false;
-
-	//right plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (clip_points[i].x < clip_points[i].w) in++;
-	}
-	if (!in) return false;
-
-	//bottom plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (-clip_points[i].w < clip_points[i].y) in++;
-	}
-	if (!in) return false;
-
-	//top plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (clip_points[i].y < clip_points[i].w) in++;
-	}
-	if (!in) return false;
-
-	//near plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (-clip_points[i].z < clip_points[i].z) in++;
-	}
-	if (!in) return false;
-
-	//far plane
-	in = 0;
-	for (int i = 0; i < 8; i++) {
-		if (clip_points[i].z < clip_points[i].w) in++;
-	}
-	if (!in) return false;
-
-	return true;
+	return new_aabb;
 }
 
 //sets viewport of graphics system
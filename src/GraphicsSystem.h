@@ -6,6 +6,8 @@
 #include "Shader.h"
 #include "Components.h"
 #include "GraphicsUtilities.h"
+#include "AABBTree.h"
+#include "OcclusionBuffer.h"
 #include <unordered_map>
 
 
@@ -16,6 +18,9 @@ public:
     void init(int window_width, int window_height, std::string assets);
     void lateInit();
     void update(float dt);
+	//update split in two, so the CPU work can be scheduled away from the GL thread
+	void prepareFrame(float dt);
+	void renderFrame();
     
 	//viewport
 	void updateMainViewport(int window_width, int window_height);
@@ -30,11 +35,31 @@ public:
     
 	//materials
     int createMaterial();
-	Material& getMaterial(int mat_id) { return materials_.at(mat_id); }
+	//the returned reference may be used to edit the material, so it is flagged
+	//for re-upload. Use the const version to only read it
+	Material& getMaterial(int mat_id) { markMaterialDirty(mat_id); return materials_.at(mat_id); }
+	const Material& getMaterial(int mat_id) const { return materials_.at(mat_id); }
+	//flags a material for re-upload, if it was edited through a reference
+	//kept from an earlier frame
+	void markMaterialDirty(int mat_id) { materials_.at(mat_id).dirty = true; }
     
     //geometry
     int createPlaneGeometry();
     int createGeometryFromFile(std::string filename);
+	//store geometries created after this call in the shared geometry arena
+	void useGeometryArena(bool use) { use_geometry_arena_ = use; }
+	//whether the arena can be drawn with glMultiDrawElementsIndirect (GL 4.3),
+	//valid after init. Without it arena geometries are drawn one by one
+	bool hasMultiDrawIndirect() const { return multi_draw_indirect_; }
+	//skip meshes hidden behind meshes flagged as occluders
+	void useOcclusionCulling(bool use) { use_occlusion_culling_ = use; }
+	//keeps a CPU copy of the triangles of a geometry loaded from file, so
+	//meshes using it can be occluders. Otherwise it is made the first frame
+	//such a mesh is visible. Returns false if the geometry has no file
+	bool prepareOccluder(int geom_id);
+
+	//world space bounds of a mesh component, valid after prepareFrame
+	const AABB& getMeshWorldAABB(int mesh_id) const { return mesh_bounds_.at(mesh_id).world; }
     
 private:
     //resources
@@ -55,11 +80,26 @@ private:
     GLint current_material_ = -1;
     void setMaterialUniforms();
 
+	//per-frame uniform buffer with camera and lights
+	GLuint frame_ubo_ = 0;
+	FrameUniformData frame_data_;
+	void fillFrameUniformData_();
+	void updateFrameUniformBuffer_();
+
+	//uniform buffer with one MaterialData block per material
+	GLuint material_ubo_ = 0;
+	GLint material_ubo_stride_ = 0;
+	size_t material_ubo_capacity_ = 0;
+	void updateMaterialUniformBuffer_();
+	void createUniformBuffers_();
+
 	//sorting and checking and abstracting
-	void sortMeshes_();
+	RenderQueue render_queue_;
+	std::vector<float> visible_depths_; //view depth of each visible mesh
+	void fillRenderQueue_();
 	void resetShaderAndMaterial_();
 	void updateAllCameras_();
-	void checkShaderAndMaterial(Mesh& mesh);
+	void checkShaderAndMaterial(int material);
 	
 	//binding and clearing
 
@@ -71,13 +111,66 @@ private:
     GLuint environment_tex_ = 0;
     
     //rendering
-    void renderMeshComponent_(Mesh& comp);
+    void addMeshInstance_(Mesh& comp, int transform_id);
+	//per mesh transform id and world bounds, refreshed in parallel, then
+	//culled by walking render_tree_ with the camera frustum
+	Frustum frustum_;
+	CullBounds cull_bounds_;
+	//world bounds of each mesh, indexed like the Mesh array. Only recalculated
+	//when the mesh's geometry or the world matrix of its transform changes
+	struct MeshBounds {
+		AABB world;
+		int transform_id = -1;
+		int geometry = -1;
+		unsigned int world_version = 0;
+		int proxy = -1; //leaf in render_tree_, whose user data is the mesh id
+	};
+	std::vector<MeshBounds> mesh_bounds_;
+	bool updateMeshBounds_(const Mesh& mesh, size_t mesh_id, int transform_id);
+	//meshes whose bounds changed this frame, one list per chunk of CULL_CHUNK
+	std::vector<std::vector<int>> moved_meshes_;
+	//bounding volume hierarchy over mesh world bounds. Slots of mesh_bounds_
+	//keep their leaf while the mesh array grows or shrinks
+	AABBTree render_tree_;
+	void updateRenderTree_();
+	std::vector<int> mesh_transforms_;
+	std::vector<int> cull_candidates_; //meshes in leaves crossing the frustum
+	std::vector<char> candidate_visible_;
+	std::vector<int> visible_meshes_; //mesh ids which passed the cull
+	static const size_t CULL_CHUNK = 128;
+
+	//occlusion culling, on the CPU after the frustum cull. Triangles are only
+	//kept for geometries used by occluders, by geometry id
+	bool use_occlusion_culling_ = true;
+	OcclusionBuffer occlusion_buffer_;
+	std::unordered_map<int, OccluderMesh> occluder_meshes_;
+	std::unordered_map<int, std::string> geometry_files_; //to load occluder triangles
+	std::vector<char> occlusion_visible_;
+	static const int OCCLUSION_WIDTH = 256;
+	static const int OCCLUSION_HEIGHT = 128;
+	void cullOccluded_();
+	static const size_t CAMERA_CHUNK = 16;
     void renderEnvironment_();
+
+	//instancing
+	GLuint instance_vbo_ = 0;
+	size_t instance_vbo_capacity_ = 0;
+	std::vector<InstanceData> instances_;
+	std::vector<InstanceBatch> batches_;
+	void uploadInstances_();
+	int first_transparent_batch_ = 0; //opaque batches come before it
+	void renderBatches_(int first, int last);
+
+	//geometry arena and multi-draw indirect (requires GL 4.3)
+	bool use_geometry_arena_ = false;
+	bool multi_draw_indirect_ = false;
+	GeometryArena geometry_arena_;
+	GLuint indirect_buffer_ = 0;
+	std::vector<DrawElementsIndirectCommand> indirect_commands_;
+	void uploadIndirectCommands_();
     
 	//AABB
 	void setGeometryAABB_(Geometry& geom, std::vector<GLfloat>& vertices);
 	AABB transformAABB_(const AABB& aabb, const lm::mat4& transform);
-	bool BBInFrustum_(const AABB& aabb, const lm::mat4& model_view_projection);
-	bool AABBInFrustum_(const AABB& aabb, const lm::mat4& view_projection);
 
 };
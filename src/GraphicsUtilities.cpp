@@ -1,4 +1,8 @@
 #include "GraphicsUtilities.h"
+#include <cstddef>
+#if defined(LM_SSE)
+#include <xmmintrin.h>
+#endif
 
 // ****** GEOMETRY ***** //
 
@@ -9,7 +13,33 @@ Geometry::Geometry(std::vector<float>& vertices, std::vector<float>& uvs, std::v
 
 void Geometry::render() {
 	glBindVertexArray(vao);
-	glDrawElements(GL_TRIANGLES, num_tris * 3, GL_UNSIGNED_INT, 0);
+	glDrawElementsBaseVertex(GL_TRIANGLES, num_tris * 3, GL_UNSIGNED_INT, (void*)(first_index * sizeof(GLuint)), base_vertex);
+	glBindVertexArray(0);
+}
+
+//draws num_instances copies of the geometry, taking per-instance attributes from
+//instance_buffer, starting at first_instance
+void Geometry::renderInstanced(GLuint instance_buffer, int first_instance, int num_instances) {
+	glBindVertexArray(vao);
+
+	//per-instance attributes are vec4 columns which advance once per instance
+	if (!instance_attribs_enabled) {
+		for (GLuint i = 0; i < INSTANCE_ATTRIB_COUNT; i++) {
+			glEnableVertexAttribArray(INSTANCE_ATTRIB_FIRST + i);
+			glVertexAttribDivisor(INSTANCE_ATTRIB_FIRST + i, 1);
+		}
+		instance_attribs_enabled = true;
+	}
+
+	//point attributes at this batch's range of the instance buffer
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+	size_t offset = first_instance * sizeof(InstanceData);
+	for (GLuint i = 0; i < INSTANCE_ATTRIB_COUNT; i++) {
+		glVertexAttribPointer(INSTANCE_ATTRIB_FIRST + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offset + i * sizeof(lm::vec4)));
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glDrawElementsInstancedBaseVertex(GL_TRIANGLES, num_tris * 3, GL_UNSIGNED_INT, (void*)(first_index * sizeof(GLuint)), num_instances, base_vertex);
 	glBindVertexArray(0);
 }
 
@@ -100,3 +130,203 @@ int Geometry::createPlaneGeometry() {
 
 	return 1;
 }
+
+// ****** GEOMETRY ARENA ***** //
+
+//appends geometry data to the arena and points geom at its sub-allocation. Nothing
+//is sent to VRAM until the next upload
+void GeometryArena::addGeometry(Geometry& geom, std::vector<float>& in_vertices, std::vector<float>& in_uvs, std::vector<float>& in_normals, std::vector<unsigned int>& in_indices) {
+	size_t num_verts = in_vertices.size() / 3;
+	if (!vao) {
+		glGenVertexArrays(1, &vao);
+		glGenBuffers(1, &vbo);
+		glGenBuffers(1, &ibo);
+	}
+	geom.vao = vao;
+	geom.in_arena = true;
+	geom.base_vertex = (GLint)vertices.size();
+	geom.first_index = (GLuint)indices.size();
+	geom.num_tris = (GLuint)in_indices.size() / 3;
+
+	//interleave, filling missing uvs or normals with zero
+	for (size_t i = 0; i < num_verts; i++) {
+		ArenaVertex v;
+		v.position = lm::vec3(in_vertices[i * 3], in_vertices[i * 3 + 1], in_vertices[i * 3 + 2]);
+		v.uv[0] = i * 2 + 1 < in_uvs.size() ? in_uvs[i * 2] : 0.0f;
+		v.uv[1] = i * 2 + 1 < in_uvs.size() ? in_uvs[i * 2 + 1] : 0.0f;
+		if (i * 3 + 2 < in_normals.size())
+			v.normal = lm::vec3(in_normals[i * 3], in_normals[i * 3 + 1], in_normals[i * 3 + 2]);
+		else
+			v.normal = lm::vec3(0.0f, 0.0f, 0.0f);
+		vertices.push_back(v);
+	}
+	indices.insert(indices.end(), in_indices.begin(), in_indices.end());
+
+	geom.setAABB(in_vertices);
+	dirty = true;
+}
+
+//sends the whole arena to VRAM and sets up its vao. Per-instance attributes read
+//from the start of instance_buffer, as indirect commands select their range with
+//base_instance
+void GeometryArena::upload(GLuint instance_buffer) {
+	if (vertices.empty()) return;
+
+	glBindVertexArray(vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(ArenaVertex), &(vertices[0]), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(ArenaVertex), (void*)offsetof(ArenaVertex, position));
+	glEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(ArenaVertex), (void*)offsetof(ArenaVertex, uv));
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(ArenaVertex), (void*)offsetof(ArenaVertex, normal));
+
+	glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+	for (GLuint i = 0; i < INSTANCE_ATTRIB_COUNT; i++) {
+		glEnableVertexAttribArray(INSTANCE_ATTRIB_FIRST + i);
+		glVertexAttribDivisor(INSTANCE_ATTRIB_FIRST + i, 1);
+		glVertexAttribPointer(INSTANCE_ATTRIB_FIRST + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(i * sizeof(lm::vec4)));
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &(indices[0]), GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	dirty = false;
+}
+
+//issues num_commands draws from indirect_buffer with a single call
+void GeometryArena::renderIndirect(GLuint indirect_buffer, size_t first_command, size_t num_commands) {
+	glBindVertexArray(vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(first_command * sizeof(DrawElementsIndirectCommand)), (GLsizei)num_commands, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+// ****** RENDER QUEUE ***** //
+
+//least significant byte first, so each pass keeps the order of the previous
+//ones. Bytes which are the same in every key, such as the pass while there is
+//only one, don't change the order and are skipped
+void RenderQueue::sort() {
+	size_t count = entries.size();
+	if (count < 2) return;
+	scratch_.resize(count);
+	Entry* src = entries.data();
+	Entry* dst = scratch_.data();
+	for (int shift = 0; shift < 64; shift += 8) {
+		size_t histogram[256] = { 0 };
+		for (size_t i = 0; i < count; i++)
+			histogram[(src[i].key >> shift) & 0xFF]++;
+		if (histogram[(src[0].key >> shift) & 0xFF] == count) continue;
+
+		size_t offset = 0;
+		for (int b = 0; b < 256; b++) {
+			size_t n = histogram[b];
+			histogram[b] = offset;
+			offset += n;
+		}
+		for (size_t i = 0; i < count; i++)
+			dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+		Entry* tmp = src; src = dst; dst = tmp;
+	}
+	if (src != entries.data()) entries.swap(scratch_);
+}
+
+// ****** CULLING ***** //
+
+//a point p is inside clip space if -w < x < w, -w < y < w and -w < z < w. With
+//clip = view_projection * p, each inequality is a plane built from the rows
+//of the matrix, e.g. left is (row 3 + row 0) . p > 0. For more info see:
+//http://www.lighthouse3d.com/tutorials/view-frustum-culling/clip-space-approach-extracting-the-planes/
+void Frustum::extract(const lm::mat4& vp) {
+	for (int i = 0; i < 3; i++) {
+		for (int k = 0; k < 4; k++) {
+			planes[i * 2][k] = vp.m[k * 4 + 3] + vp.m[k * 4 + i];
+			planes[i * 2 + 1][k] = vp.m[k * 4 + 3] - vp.m[k * 4 + i];
+		}
+	}
+}
+
+//the corner of a box furthest along a plane normal is center + |normal| *
+//half_width, and the nearest is center - |normal| * half_width. The box is
+//outside if the furthest is behind any plane, and inside if the nearest is in
+//front of all of them
+int Frustum::classify(const lm::vec3& min, const lm::vec3& max) const {
+	lm::vec3 center = (min + max) * 0.5f;
+	lm::vec3 half_width = (max - min) * 0.5f;
+	int result = 1;
+	for (int p = 0; p < 6; p++) {
+		const float* plane = planes[p];
+		float dist = plane[0] * center.x + plane[1] * center.y + plane[2] * center.z + plane[3];
+		float radius = fabs(plane[0]) * half_width.x + fabs(plane[1]) * half_width.y + fabs(plane[2]) * half_width.z;
+		if (dist + radius < 0.0f) return -1;
+		if (dist - radius < 0.0f) result = 0;
+	}
+	return result;
+}
+
+void CullBounds::resize(size_t count) {
+	for (int k = 0; k < 3; k++) {
+		center[k].resize(count, 0.0f);
+		half_width[k].resize(count, 0.0f);
+	}
+}
+
+void CullBounds::set(size_t i, const AABB& aabb) {
+	for (int k = 0; k < 3; k++) {
+		center[k][i] = aabb.center.value_[k];
+		half_width[k][i] = aabb.half_width.value_[k];
+	}
+}
+
+//same test as Frustum::classify, without the inside case. The SSE version
+//gathers four boxes into registers and tests them against each plane at once
+void cullAABBs(const Frustum& frustum, const CullBounds& bounds, const int* ids, size_t count, char* visible) {
+#if defined(LM_SSE)
+	const __m128 sign_mask = _mm_set1_ps(-0.0f);
+	for (size_t i = 0; i < count; i += 4) {
+		//repeat the last box to fill a partial group
+		int g[4];
+		for (size_t k = 0; k < 4; k++) g[k] = ids[i + k < count ? i + k : count - 1];
+		__m128 c[3], h[3];
+		for (int k = 0; k < 3; k++) {
+			const float* cs = bounds.center[k].data();
+			const float* hs = bounds.half_width[k].data();
+			c[k] = _mm_setr_ps(cs[g[0]], cs[g[1]], cs[g[2]], cs[g[3]]);
+			h[k] = _mm_setr_ps(hs[g[0]], hs[g[1]], hs[g[2]], hs[g[3]]);
+		}
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < 6; p++) {
+			const float* plane = frustum.planes[p];
+			__m128 nx = _mm_set1_ps(plane[0]), ny = _mm_set1_ps(plane[1]), nz = _mm_set1_ps(plane[2]);
+			__m128 dist = _mm_add_ps(_mm_mul_ps(nx, c[0]), _mm_mul_ps(ny, c[1]));
+			dist = _mm_add_ps(dist, _mm_mul_ps(nz, c[2]));
+			dist = _mm_add_ps(dist, _mm_set1_ps(plane[3]));
+			dist = _mm_add_ps(dist, _mm_mul_ps(_mm_andnot_ps(sign_mask, nx), h[0]));
+			dist = _mm_add_ps(dist, _mm_mul_ps(_mm_andnot_ps(sign_mask, ny), h[1]));
+			dist = _mm_add_ps(dist, _mm_mul_ps(_mm_andnot_ps(sign_mask, nz), h[2]));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(dist, _mm_setzero_ps()));
+		}
+		int mask = _mm_movemask_ps(outside);
+		for (size_t k = 0; k < 4 && i + k < count; k++)
+			visible[i + k] = (mask >> k) & 1 ? 0 : 1;
+	}
+#else
+	for (size_t i = 0; i < count; i++) {
+		int id = ids[i];
+		bool outside = false;
+		for (int p = 0; p < 6 && !outside; p++) {
+			const float* plane = frustum.planes[p];
+			float dist = plane[0] * bounds.center[0][id] + plane[1] * bounds.center[1][id] + plane[2] * bounds.center[2][id] + plane[3] +
+				fabs(plane[0]) * bounds.half_width[0][id] + fabs(plane[1]) * bounds.half_width[1][id] + fabs(plane[2]) * bounds.half_width[2][id];
+			outside = dist < 0.0f;
+		}
+		visible[i] = outside ? 0 : 1;
+	}
+#endif
+}
@@ -7,10 +7,57 @@ struct AABB {
 	lm::vec3 half_width;
 };
 
+//planes of a camera's view frustum, extracted from its view projection
+//matrix. Each is a, b, c, d with points inside where ax + by + cz + d >= 0
+struct Frustum {
+	float planes[6][4];
+	void extract(const lm::mat4& view_projection);
+	//returns -1 if box is outside, 1 if inside and 0 if it crosses a plane
+	int classify(const lm::vec3& min, const lm::vec3& max) const;
+};
+
+//world space bounds of many boxes, one array per component so that four
+//boxes are tested at once
+struct CullBounds {
+	std::vector<float> center[3];
+	std::vector<float> half_width[3];
+	void resize(size_t count);
+	void set(size_t i, const AABB& aabb);
+};
+
+//sets visible[k] to 1 if box ids[k] is at least partly in the frustum, and
+//0 otherwise
+void cullAABBs(const Frustum& frustum, const CullBounds& bounds, const int* ids, size_t count, char* visible);
+
+//per-instance data streamed to the instance buffer every frame. Vertex shaders
+//read model matrix as attribute 3 (locations 3-6) and normal matrix as attribute 7 (7-10)
+const GLuint INSTANCE_ATTRIB_FIRST = 3;
+const GLuint INSTANCE_ATTRIB_COUNT = 8;
+struct InstanceData {
+	lm::mat4 model;
+	lm::mat4 normal_matrix;
+};
+
+//run of consecutive visible meshes with the same geometry and material,
+//drawn with a single instanced draw call
+struct InstanceBatch {
+	int geometry;
+	int material;
+	int first_instance;
+	int num_instances;
+};
+
 struct Geometry {
 	GLuint vao;
 	GLuint num_tris;
 	AABB aabb;
+	bool instance_attribs_enabled = false;
+
+	//geometries stored in a GeometryArena share its vao, and are drawn from
+	//first_index, with base_vertex added to each index
+	bool in_arena = false;
+	GLuint first_index = 0;
+	GLint base_vertex = 0;
 	
 	//constrctors
 	Geometry() { vao = 0; num_tris = 0; }
@@ -24,6 +71,118 @@ struct Geometry {
 
 	//rendering functions
 	void render();
+	void renderInstanced(GLuint instance_buffer, int first_instance, int num_instances);
+};
+
+//passes in draw order. The environment is drawn between the two
+enum RenderPass {
+	RenderPassOpaque = 0,
+	RenderPassTransparent = 1
+};
+
+//visible meshes of a frame in draw order. Each has a 64 bit key with the pass
+//in the top bits, so sorting the keys orders passes, and then meshes within
+//each pass as described below
+struct RenderQueue {
+	//key fields, as shift and width in bits, from the top down
+	static const int PASS_BITS = 4;
+	static const int PASS_SHIFT = 64 - PASS_BITS;
+	//opaque layout
+	static const int OPAQUE_BUCKET_BITS = 4;
+	static const int OPAQUE_BUCKET_SHIFT = PASS_SHIFT - OPAQUE_BUCKET_BITS;
+	static const int OPAQUE_SHADER_BITS = 12;
+	static const int OPAQUE_SHADER_SHIFT = OPAQUE_BUCKET_SHIFT - OPAQUE_SHADER_BITS;
+	static const int OPAQUE_MATERIAL_BITS = 16;
+	static const int OPAQUE_MATERIAL_SHIFT = OPAQUE_SHADER_SHIFT - OPAQUE_MATERIAL_BITS;
+	static const int OPAQUE_GEOMETRY_BITS = 16;
+	static const int OPAQUE_GEOMETRY_SHIFT = OPAQUE_MATERIAL_SHIFT - OPAQUE_GEOMETRY_BITS;
+	static const int OPAQUE_DEPTH_BITS = 12; //bucket is the top bits of this depth
+	static const int OPAQUE_DEPTH_SHIFT = OPAQUE_GEOMETRY_SHIFT - OPAQUE_DEPTH_BITS;
+	//transparent layout
+	static const int TRANSPARENT_DEPTH_BITS = 28;
+	static const int TRANSPARENT_DEPTH_SHIFT = PASS_SHIFT - TRANSPARENT_DEPTH_BITS;
+	static const int TRANSPARENT_MATERIAL_BITS = 16;
+	static const int TRANSPARENT_MATERIAL_SHIFT = TRANSPARENT_DEPTH_SHIFT - TRANSPARENT_MATERIAL_BITS;
+	static const int TRANSPARENT_GEOMETRY_BITS = 16;
+	static const int TRANSPARENT_GEOMETRY_SHIFT = TRANSPARENT_MATERIAL_SHIFT - TRANSPARENT_GEOMETRY_BITS;
+
+	//each layout packs its fields below the pass without overlap, down to bit 0
+	static_assert(OPAQUE_DEPTH_SHIFT == 0, "opaque key fields don't fit in 64 bits");
+	static_assert(OPAQUE_BUCKET_BITS <= OPAQUE_DEPTH_BITS, "opaque depth bucket is wider than depth");
+	static_assert(TRANSPARENT_GEOMETRY_SHIFT == 0, "transparent key fields don't fit in 64 bits");
+	static_assert(RenderPassTransparent < (1 << PASS_BITS), "render pass doesn't fit in key");
+
+	//lowest bits of value
+	static unsigned long long field(unsigned long long value, int bits) { return value & ((1ULL << bits) - 1); }
+
+	struct Entry {
+		unsigned long long key;
+		int mesh;
+	};
+	std::vector<Entry> entries;
+
+	static RenderPass getPass(unsigned long long key) { return (RenderPass)(key >> PASS_SHIFT); }
+
+	//opaque meshes are sorted by a coarse depth bucket, so near meshes are
+	//drawn first and let early depth testing skip what they hide, then by
+	//shader, material and geometry to keep state changes few, then by depth.
+	//Depth goes from 0 (near) to 1 (far)
+	static unsigned long long makeOpaqueKey(int shader, int material, int geometry, float depth) {
+		unsigned long long fine = (unsigned long long)(depth * ((1 << OPAQUE_DEPTH_BITS) - 1));
+		unsigned long long bucket = fine >> (OPAQUE_DEPTH_BITS - OPAQUE_BUCKET_BITS);
+		return ((unsigned long long)RenderPassOpaque << PASS_SHIFT) |
+			(field(bucket, OPAQUE_BUCKET_BITS) << OPAQUE_BUCKET_SHIFT) |
+			(field(shader, OPAQUE_SHADER_BITS) << OPAQUE_SHADER_SHIFT) |
+			(field(material, OPAQUE_MATERIAL_BITS) << OPAQUE_MATERIAL_SHIFT) |
+			(field(geometry, OPAQUE_GEOMETRY_BITS) << OPAQUE_GEOMETRY_SHIFT) |
+			(field(fine, OPAQUE_DEPTH_BITS) << OPAQUE_DEPTH_SHIFT);
+	}
+	//transparent meshes must blend back to front, so depth comes first,
+	//inverted so the furthest mesh has the smallest key
+	static unsigned long long makeTransparentKey(int material, int geometry, float depth) {
+		unsigned long long inverse_depth = (unsigned long long)((1.0f - depth) * ((1 << TRANSPARENT_DEPTH_BITS) - 1));
+		return ((unsigned long long)RenderPassTransparent << PASS_SHIFT) |
+			(field(inverse_depth, TRANSPARENT_DEPTH_BITS) << TRANSPARENT_DEPTH_SHIFT) |
+			(field(material, TRANSPARENT_MATERIAL_BITS) << TRANSPARENT_MATERIAL_SHIFT) |
+			(field(geometry, TRANSPARENT_GEOMETRY_BITS) << TRANSPARENT_GEOMETRY_SHIFT);
+	}
+	//stable radix sort of the entries by key, a byte at a time
+	void sort();
+
+private:
+	std::vector<Entry> scratch_;
+};
+
+//layout of one command in a GL_DRAW_INDIRECT_BUFFER, as read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint base_instance;
+};
+
+//interleaved vertex stored in the geometry arena
+struct ArenaVertex {
+	lm::vec3 position;
+	float uv[2];
+	lm::vec3 normal;
+};
+
+//one large interleaved vertex buffer and index buffer shared by many geometries,
+//all drawn through the same vao. Geometries are appended on the CPU and the whole
+//arena is (re)uploaded when it changes
+struct GeometryArena {
+	GLuint vao = 0;
+	GLuint vbo = 0;
+	GLuint ibo = 0;
+	std::vector<ArenaVertex> vertices;
+	std::vector<GLuint> indices;
+	bool dirty = false;
+
+	void addGeometry(Geometry& geom, std::vector<float>& vertices, std::vector<float>& uvs, std::vector<float>& normals, std::vector<unsigned int>& indices);
+	void upload(GLuint instance_buffer);
+	void renderIndirect(GLuint indirect_buffer, size_t first_command, size_t num_commands);
 };
 
 struct Material {
@@ -34,10 +193,15 @@ struct Material {
 	lm::vec3 diffuse;
 	lm::vec3 specular;
 	float specular_gloss;
+	//below 1, meshes are drawn in the transparent pass, blended back to front
+	float opacity;
 
 	int diffuse_map;
 	int cube_map;
 
+	//true if parameters changed since last upload to material uniform buffer
+	bool dirty = true;
+
 	Material() {
 		name = "";
 		ambient = lm::vec3(0.1f, 0.1f, 0.1f);
@@ -46,5 +210,45 @@ struct Material {
 		diffuse_map = -1;
 		cube_map = -1;
 		specular_gloss = 80.0f;
+		opacity = 1.0f;
 	}
-};
\ No newline at end of file
+	bool isTransparent() const { return opacity < 1.0f; }
+};
+
+//maximum number of lights in the FrameData uniform block, must match MAX_LIGHTS in shaders
+const int MAX_LIGHTS = 8;
+
+//a single light, laid out following std140 rules (vec3 followed by a float fills 16 bytes)
+struct LightUniformData {
+	lm::vec3 position;
+	float linear_att;
+	lm::vec3 direction;
+	float quadratic_att;
+	lm::vec3 color;
+	float spot_inner_cosine;
+	float spot_outer_cosine;
+	int type;
+	float padding[2];
+};
+
+//CPU copy of the std140 FrameData uniform block, uploaded once per frame
+struct FrameUniformData {
+	lm::mat4 view;
+	lm::mat4 projection;
+	lm::vec3 cam_pos;
+	int num_lights;
+	LightUniformData lights[MAX_LIGHTS];
+};
+
+//CPU copy of the std140 MaterialData uniform block. One is stored per material
+//in the material uniform buffer, each at a multiple of the buffer offset alignment
+struct MaterialUniformData {
+	lm::vec3 ambient;
+	float specular_gloss;
+	lm::vec3 diffuse;
+	int use_diffuse_map;
+	lm::vec3 specular;
+	int use_reflection_map;
+	float opacity;
+	float padding[3];
+};
@@ -0,0 +1,123 @@
+#include "JobSystem.h"
+
+//queue of the current thread, set when a worker starts. Other threads use 0
+static thread_local int tls_queue_index = 0;
+//job system the current thread works for, so pools don't share indices
+static thread_local JobSystem* tls_job_system = nullptr;
+
+//stop and join all workers
+JobSystem::~JobSystem() {
+	{
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		quit_ = true;
+	}
+	sleep_cv_.notify_all();
+	for (auto& worker : workers_)
+		worker.join();
+}
+
+//starts worker threads, each with its own queue
+void JobSystem::init(int num_workers) {
+	if (num_workers < 0) {
+		num_workers = (int)std::thread::hardware_concurrency() - 1;
+		if (num_workers < 0) num_workers = 0;
+	}
+	for (int i = 0; i < num_workers + 1; i++)
+		queues_.emplace_back(new WorkerQueue());
+	for (int i = 0; i < num_workers; i++)
+		workers_.emplace_back(&JobSystem::workerLoop_, this, i + 1);
+}
+
+int JobSystem::currentQueue_() {
+	return tls_job_system == this ? tls_queue_index : 0;
+}
+
+//pushes job onto the back of the calling thread's queue
+void JobSystem::add(std::function<void()> job, JobCounter* counter) {
+	if (counter) (*counter)++;
+	pending_++;
+
+	//nothing can run it in parallel, so run it now
+	if (queues_.empty() || deterministic_) {
+		Job inline_job{ std::move(job), counter };
+		runJob_(inline_job);
+		return;
+	}
+
+	WorkerQueue& queue = *queues_[currentQueue_()];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(Job{ std::move(job), counter });
+	}
+	queued_++;
+	{
+		//lock so a worker about to sleep can't miss the notification
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+	}
+	sleep_cv_.notify_one();
+}
+
+//own queue is popped from the back (most recent first), others from the front
+bool JobSystem::popOrSteal_(int queue_index, Job& job) {
+	if (queued_ == 0) return false;
+	int num_queues = (int)queues_.size();
+	for (int k = 0; k < num_queues; k++) {
+		int i = (queue_index + k) % num_queues;
+		WorkerQueue& queue = *queues_[i];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty()) continue;
+		if (k == 0) {
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		else {
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+		queued_--;
+		return true;
+	}
+	return false;
+}
+
+void JobSystem::runJob_(Job& job) {
+	job.run();
+	if (job.counter) (*job.counter)--;
+	if (--pending_ == 0 || job.counter) {
+		//wake threads waiting for the counter or for all jobs
+		std::lock_guard<std::mutex> lock(sleep_mutex_);
+		sleep_cv_.notify_all();
+	}
+}
+
+void JobSystem::waitFor(JobCounter& counter) {
+	int queue_index = currentQueue_();
+	Job job;
+	while (counter > 0) {
+		if (popOrSteal_(queue_index, job)) {
+			runJob_(job);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_mutex_);
+		sleep_cv_.wait(lock, [this, &counter] { return counter == 0 || queued_ > 0; });
+	}
+}
+
+void JobSystem::wait() {
+	waitFor(pending_);
+}
+
+void JobSystem::workerLoop_(int queue_index) {
+	tls_queue_index = queue_index;
+	tls_job_system = this;
+	Job job;
+	while (true) {
+		if (popOrSteal_(queue_index, job)) {
+			runJob_(job);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_mutex_);
+		sleep_cv_.wait(lock, [this] { return quit_ || queued_ > 0; });
+		if (quit_) return;
+	}
+}
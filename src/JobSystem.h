@@ -0,0 +1,91 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <memory>
+
+//counts unfinished jobs of a group, so a caller can wait for just its own jobs
+typedef std::atomic<int> JobCounter;
+
+//pool of worker threads with work stealing. Each thread pushes jobs onto its
+//own deque and pops them from the back, idle threads steal from the front of
+//the others. Threads which are not workers (i.e. the main thread) share one
+//extra deque. Waiting threads run jobs instead of sleeping while any are queued
+class JobSystem {
+public:
+	~JobSystem();
+	//num_workers < 0 uses one worker per hardware thread, minus the main thread
+	void init(int num_workers = -1);
+	int numWorkers() const { return (int)workers_.size(); }
+
+	//queues job. If counter is given, it is incremented now and decremented
+	//when the job finishes
+	void add(std::function<void()> job, JobCounter* counter = nullptr);
+	//blocks until counter reaches zero, running queued jobs meanwhile
+	void waitFor(JobCounter& counter);
+	//blocks until every job added so far has finished
+	void wait();
+
+	//deterministic mode runs everything on the calling thread in submission
+	//order, so results can be compared between runs. Turned on at startup by
+	//passing --deterministic on the command line, see main.cpp
+	void setDeterministic(bool deterministic) { deterministic_ = deterministic; }
+	bool isDeterministic() const { return deterministic_; }
+
+	//calls fn(begin, end) for consecutive ranges of at most chunk items covering
+	//[0, count), and returns when all have finished. A single chunk, no workers
+	//or deterministic mode run inline without touching any queue
+	template<typename F>
+	void parallelFor(size_t count, size_t chunk, F fn) {
+		if (chunk == 0) chunk = 1;
+		if (count <= chunk || workers_.empty() || deterministic_) {
+			for (size_t begin = 0; begin < count; begin += chunk)
+				fn(begin, begin + chunk < count ? begin + chunk : count);
+			return;
+		}
+		JobCounter counter(0);
+		for (size_t begin = chunk; begin < count; begin += chunk) {
+			size_t end = begin + chunk < count ? begin + chunk : count;
+			add([&fn, begin, end] { fn(begin, end); }, &counter);
+		}
+		//calling thread does the first chunk itself
+		fn(0, chunk);
+		waitFor(counter);
+	}
+
+	//calls fn(item, index) for each item of a component (or any) array
+	template<typename T, typename F>
+	void parallelFor(std::vector<T>& items, size_t chunk, F fn) {
+		parallelFor(items.size(), chunk, [&items, &fn](size_t begin, size_t end) {
+			for (size_t i = begin; i < end; i++) fn(items[i], i);
+		});
+	}
+
+private:
+	struct Job {
+		std::function<void()> run;
+		JobCounter* counter;
+	};
+	struct WorkerQueue {
+		std::deque<Job> jobs;
+		std::mutex mutex;
+	};
+
+	std::vector<std::thread> workers_;
+	std::vector<std::unique_ptr<WorkerQueue>> queues_; //0 is shared by non-workers
+	std::atomic<int> queued_{ 0 }; //jobs in any queue
+	std::atomic<int> pending_{ 0 }; //jobs added but not yet finished
+	std::mutex sleep_mutex_;
+	std::condition_variable sleep_cv_;
+	std::atomic<bool> quit_{ false };
+	bool deterministic_ = false;
+
+	void workerLoop_(int queue_index);
+	bool popOrSteal_(int queue_index, Job& job);
+	void runJob_(Job& job);
+	int currentQueue_();
+};
@@ -0,0 +1,248 @@
+#include "MeshBVH.h"
+#include <cfloat>
+#include <fstream>
+
+using namespace lm;
+
+// ****** BUILD ***** //
+
+//half the surface area, which is all the split cost needs
+static float boxArea(const vec3& min, const vec3& max) {
+	vec3 d = max - min;
+	return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+struct SAHBin {
+	vec3 min = vec3(FLT_MAX, FLT_MAX, FLT_MAX);
+	vec3 max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	int count = 0;
+	void grow(const vec3& p) {
+		if (p.x < min.x) min.x = p.x;
+		if (p.y < min.y) min.y = p.y;
+		if (p.z < min.z) min.z = p.z;
+		if (p.x > max.x) max.x = p.x;
+		if (p.y > max.y) max.y = p.y;
+		if (p.z > max.z) max.z = p.z;
+	}
+	void grow(const SAHBin& b) {
+		if (b.count == 0) return;
+		grow(b.min);
+		grow(b.max);
+		count += b.count;
+	}
+};
+
+void MeshBVH::build(const std::vector<float>& vertices, const std::vector<unsigned int>& indices) {
+	nodes_.clear();
+	triangles_.clear();
+	size_t num_triangles = indices.size() / 3;
+	if (num_triangles == 0) return;
+
+	//copy triangle vertices, so leaves can read them in order without the index array
+	triangles_.resize(num_triangles * 3);
+	std::vector<vec3> centroids(num_triangles);
+	for (size_t t = 0; t < num_triangles; t++) {
+		for (int k = 0; k < 3; k++) {
+			size_t v = indices[t * 3 + k] * 3;
+			triangles_[t * 3 + k] = vec3(vertices[v], vertices[v + 1], vertices[v + 2]);
+		}
+		centroids[t] = (triangles_[t * 3] + triangles_[t * 3 + 1] + triangles_[t * 3 + 2]) * (1.0f / 3.0f);
+	}
+
+	//root, then an unused node so that each pair of children starts at an even
+	//index, and shares a cache line
+	nodes_.reserve(num_triangles * 2 + 1);
+	MeshBVHNode root;
+	root.first = 0;
+	root.count = (int)num_triangles;
+	nodes_.push_back(root);
+	nodes_.push_back(MeshBVHNode());
+	updateBounds_(nodes_[0]);
+	subdivide_(0, centroids, 0);
+
+	bounds_min_ = vec3(nodes_[0].min[0], nodes_[0].min[1], nodes_[0].min[2]);
+	bounds_max_ = vec3(nodes_[0].max[0], nodes_[0].max[1], nodes_[0].max[2]);
+}
+
+void MeshBVH::updateBounds_(MeshBVHNode& node) const {
+	SAHBin bounds;
+	for (int i = node.first * 3; i < (node.first + node.count) * 3; i++)
+		bounds.grow(triangles_[i]);
+	for (int k = 0; k < 3; k++) {
+		node.min[k] = bounds.min.value_[k];
+		node.max[k] = bounds.max.value_[k];
+	}
+}
+
+//splits node at the binned split plane with least surface area cost, if it's
+//cheaper than leaving the node as a leaf
+void MeshBVH::subdivide_(int node_id, std::vector<vec3>& centroids, int depth) {
+	MeshBVHNode node = nodes_[node_id];
+	if (node.count <= MAX_LEAF_TRIANGLES || depth >= STACK_SIZE - 2) return;
+
+	//bins are spread over the bounds of the centroids, not the triangles
+	SAHBin centroid_bounds;
+	for (int i = node.first; i < node.first + node.count; i++)
+		centroid_bounds.grow(centroids[i]);
+
+	float best_cost = FLT_MAX;
+	int best_axis = -1;
+	int best_split = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		float axis_min = centroid_bounds.min.value_[axis];
+		float axis_max = centroid_bounds.max.value_[axis];
+		if (axis_max <= axis_min) continue;
+		float scale = SAH_BINS / (axis_max - axis_min);
+
+		SAHBin bins[SAH_BINS];
+		for (int i = node.first; i < node.first + node.count; i++) {
+			int b = (int)((centroids[i].value_[axis] - axis_min) * scale);
+			if (b > SAH_BINS - 1) b = SAH_BINS - 1;
+			SAHBin triangle;
+			triangle.grow(triangles_[i * 3]);
+			triangle.grow(triangles_[i * 3 + 1]);
+			triangle.grow(triangles_[i * 3 + 2]);
+			triangle.count = 1;
+			bins[b].grow(triangle);
+		}
+
+		//sweep from both sides to get the cost of each split between bins
+		float left_cost[SAH_BINS - 1];
+		SAHBin left, right;
+		for (int b = 0; b < SAH_BINS - 1; b++) {
+			left.grow(bins[b]);
+			left_cost[b] = left.count ? left.count * boxArea(left.min, left.max) : 0.0f;
+		}
+		for (int b = SAH_BINS - 1; b > 0; b--) {
+			right.grow(bins[b]);
+			if (right.count == 0 || right.count == node.count) continue;
+			float cost = left_cost[b - 1] + right.count * boxArea(right.min, right.max);
+			if (cost < best_cost) {
+				best_cost = cost;
+				best_axis = axis;
+				best_split = b;
+			}
+		}
+	}
+
+	vec3 node_min(node.min[0], node.min[1], node.min[2]);
+	vec3 node_max(node.max[0], node.max[1], node.max[2]);
+	float leaf_cost = node.count * boxArea(node_min, node_max);
+	if (best_axis == -1 || best_cost >= leaf_cost) return;
+
+	//partition triangles in place, by the bin of their centroid
+	float axis_min = centroid_bounds.min.value_[best_axis];
+	float scale = SAH_BINS / (centroid_bounds.max.value_[best_axis] - axis_min);
+	int i = node.first;
+	int j = node.first + node.count - 1;
+	while (i <= j) {
+		int b = (int)((centroids[i].value_[best_axis] - axis_min) * scale);
+		if (b > SAH_BINS - 1) b = SAH_BINS - 1;
+		if (b < best_split) {
+			i++;
+		}
+		else {
+			vec3 c = centroids[i]; centroids[i] = centroids[j]; centroids[j] = c;
+			for (int k = 0; k < 3; k++) {
+				vec3 v = triangles_[i * 3 + k];
+				triangles_[i * 3 + k] = triangles_[j * 3 + k];
+				triangles_[j * 3 + k] = v;
+			}
+			j--;
+		}
+	}
+	int left_count = i - node.first;
+	if (left_count == 0 || left_count == node.count) return;
+
+	int left_id = (int)nodes_.size();
+	MeshBVHNode left_node, right_node;
+	left_node.first = node.first;
+	left_node.count = left_count;
+	right_node.first = i;
+	right_node.count = node.count - left_count;
+	nodes_.push_back(left_node);
+	nodes_.push_back(right_node);
+	updateBounds_(nodes_[left_id]);
+	updateBounds_(nodes_[left_id + 1]);
+
+	nodes_[node_id].first = left_id;
+	nodes_[node_id].count = 0;
+	subdivide_(left_id, centroids, depth + 1);
+	subdivide_(left_id + 1, centroids, depth + 1);
+}
+
+// ****** FILES ***** //
+
+//file starts with this header, followed by the nodes and triangle vertices
+struct MeshBVHFileHeader {
+	char magic[4];
+	unsigned int version;
+	unsigned long long source_hash;
+	unsigned int num_nodes;
+	unsigned int num_triangles;
+};
+static const unsigned int MESH_BVH_FILE_VERSION = 1;
+
+bool MeshBVH::save(const std::string& filename, unsigned long long source_hash) const {
+	std::ofstream file(filename, std::ios::binary);
+	if (!file) return false;
+	MeshBVHFileHeader header = { { 'M', 'B', 'V', 'H' }, MESH_BVH_FILE_VERSION, source_hash,
+		(unsigned int)nodes_.size(), (unsigned int)getNumTriangles() };
+	file.write((const char*)&header, sizeof(header));
+	file.write((const char*)nodes_.data(), sizeof(MeshBVHNode) * nodes_.size());
+	file.write((const char*)triangles_.data(), sizeof(vec3) * triangles_.size());
+	return file.good();
+}
+
+bool MeshBVH::load(const std::string& filename, unsigned long long source_hash) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) return false;
+	MeshBVHFileHeader header;
+	file.read((char*)&header, sizeof(header));
+	bool ok = file.good() &&
+		header.magic[0] == 'M' && header.magic[1] == 'B' && header.magic[2] == 'V' && header.magic[3] == 'H' &&
+		header.version == MESH_BVH_FILE_VERSION &&
+		header.source_hash == source_hash &&
+		header.num_nodes > 0;
+	if (ok) {
+		nodes_.resize(header.num_nodes);
+		triangles_.resize(header.num_triangles * 3);
+		file.read((char*)nodes_.data(), sizeof(MeshBVHNode) * nodes_.size());
+		file.read((char*)triangles_.data(), sizeof(vec3) * triangles_.size());
+		ok = file.good() && isValid_();
+	}
+	if (!ok) {
+		nodes_.clear();
+		triangles_.clear();
+		return false;
+	}
+	bounds_min_ = vec3(nodes_[0].min[0], nodes_[0].min[1], nodes_[0].min[2]);
+	bounds_max_ = vec3(nodes_[0].max[0], nodes_[0].max[1], nodes_[0].max[2]);
+	return true;
+}
+
+//checks the nodes reachable from the root, so a damaged file can't make
+//raycast read outside the arrays. Leaves must hold triangles which exist,
+//children must exist and come after their parent, as the build places them,
+//and the tree must be no deeper than the build allows
+bool MeshBVH::isValid_() const {
+	int num_nodes = (int)nodes_.size();
+	int num_triangles = (int)getNumTriangles();
+	std::vector<std::pair<int, int>> stack; //node and its depth
+	stack.push_back(std::make_pair(0, 0));
+	while (!stack.empty()) {
+		int node_id = stack.back().first;
+		int depth = stack.back().second;
+		stack.pop_back();
+		const MeshBVHNode& node = nodes_[node_id];
+		if (node.isLeaf()) {
+			if (node.first < 0 || node.count > num_triangles - node.first) return false;
+			continue;
+		}
+		if (node.count < 0 || node.first <= node_id || node.first >= num_nodes - 1 || depth + 1 > STACK_SIZE - 2)
+			return false;
+		stack.push_back(std::make_pair(node.first, depth + 1));
+		stack.push_back(std::make_pair(node.first + 1, depth + 1));
+	}
+	return true;
+}
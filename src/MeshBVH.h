@@ -0,0 +1,128 @@
+#pragma once
+#include "linmath.h"
+#include <vector>
+#include <string>
+#include <cstddef>
+
+//allocator which aligns arrays to a cache line. std::allocator only guarantees
+//the alignment of the largest fundamental type before C++17
+template<typename T>
+struct CacheAlignedAllocator {
+	typedef T value_type;
+	static const size_t ALIGNMENT = 64;
+	CacheAlignedAllocator() {}
+	template<typename U> CacheAlignedAllocator(const CacheAlignedAllocator<U>&) {}
+	T* allocate(size_t n) {
+		//over allocate, and store the original pointer just before the aligned block
+		char* raw = static_cast<char*>(::operator new(n * sizeof(T) + ALIGNMENT + sizeof(void*)));
+		size_t aligned = (reinterpret_cast<size_t>(raw) + sizeof(void*) + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+		reinterpret_cast<void**>(aligned)[-1] = raw;
+		return reinterpret_cast<T*>(aligned);
+	}
+	void deallocate(T* p, size_t) {
+		::operator delete(reinterpret_cast<void**>(p)[-1]);
+	}
+	template<typename U> bool operator==(const CacheAlignedAllocator<U>&) const { return true; }
+	template<typename U> bool operator!=(const CacheAlignedAllocator<U>&) const { return false; }
+};
+
+//node of a MeshBVH, 32 bytes so two fit in a cache line. Leaves (count > 0)
+//hold triangles first to first + count, internal nodes have their two
+//children next to each other at first and first + 1
+struct alignas(32) MeshBVHNode {
+	float min[3];
+	int first = 0;
+	float max[3];
+	int count = 0;
+	bool isLeaf() const { return count > 0; }
+};
+static_assert(sizeof(MeshBVHNode) == 32, "MeshBVHNode should be 32 bytes");
+
+//static bounding volume hierarchy over the triangles of a mesh, in the mesh's
+//local space. Built top down with the surface area heuristic, and can be
+//saved to a file so it isn't rebuilt each time the mesh is loaded
+class MeshBVH {
+public:
+	//most triangles in a leaf, and bins used to evaluate splits
+	static const int MAX_LEAF_TRIANGLES = 4;
+	static const int SAH_BINS = 12;
+
+	//builds from vertex positions (three floats each) and triangle indices,
+	//as produced by Parsers::parseOBJ
+	void build(const std::vector<float>& vertices, const std::vector<unsigned int>& indices);
+
+	//file is only loaded if it was saved with the same source hash, so a
+	//changed mesh is rebuilt
+	bool save(const std::string& filename, unsigned long long source_hash) const;
+	bool load(const std::string& filename, unsigned long long source_hash);
+
+	bool empty() const { return nodes_.empty(); }
+	size_t getNumTriangles() const { return triangles_.size() / 3; }
+	const lm::vec3& getMin() const { return bounds_min_; }
+	const lm::vec3& getMax() const { return bounds_max_; }
+	//vertices of triangle, in BVH order
+	const lm::vec3* getTriangle(int triangle) const { return &triangles_[triangle * 3]; }
+
+	//calls callback(triangle, max_t) for each triangle in a leaf hit by the segment
+	//p -> p + pq, no further than max_t (0 to 1). The callback returns the new
+	//max_t, so once a hit is found, nodes further away are skipped. Nearer
+	//children are visited first
+	template<typename F>
+	void raycast(const lm::vec3& p, const lm::vec3& pq, float max_t, F callback) const {
+		if (nodes_.empty()) return;
+		const float o[3] = { p.x, p.y, p.z };
+		const float inv_dir[3] = { 1.0f / pq.x, 1.0f / pq.y, 1.0f / pq.z };
+		int stack[STACK_SIZE];
+		int stack_size = 0;
+		stack[stack_size++] = 0;
+		while (stack_size > 0) {
+			const MeshBVHNode& node = nodes_[stack[--stack_size]];
+			if (node.isLeaf()) {
+				for (int i = 0; i < node.count; i++)
+					max_t = callback(node.first + i, max_t);
+				continue;
+			}
+			float t_left, t_right;
+			bool hit_left = segmentHitsNode_(o, inv_dir, max_t, nodes_[node.first], t_left);
+			bool hit_right = segmentHitsNode_(o, inv_dir, max_t, nodes_[node.first + 1], t_right);
+			//push the further child first, so the nearer one is popped first
+			if (hit_left && hit_right) {
+				bool left_first = t_left <= t_right;
+				stack[stack_size++] = left_first ? node.first + 1 : node.first;
+				stack[stack_size++] = left_first ? node.first : node.first + 1;
+			}
+			else if (hit_left) stack[stack_size++] = node.first;
+			else if (hit_right) stack[stack_size++] = node.first + 1;
+		}
+	}
+
+private:
+	//traversal stack holds at most one node per level plus the one being
+	//visited, so the build stops splitting two levels short of this
+	static const int STACK_SIZE = 64;
+
+	std::vector<MeshBVHNode, CacheAlignedAllocator<MeshBVHNode>> nodes_;
+	std::vector<lm::vec3> triangles_; //three vertices per triangle, in leaf order
+	lm::vec3 bounds_min_;
+	lm::vec3 bounds_max_;
+
+	void subdivide_(int node_id, std::vector<lm::vec3>& centroids, int depth);
+	void updateBounds_(MeshBVHNode& node) const;
+	bool isValid_() const;
+
+	static bool segmentHitsNode_(const float* o, const float* inv_dir, float max_t, const MeshBVHNode& node, float& t_enter) {
+		float t_min = 0.0f;
+		float t_max = max_t;
+		for (int k = 0; k < 3; k++) {
+			float t1 = (node.min[k] - o[k]) * inv_dir[k];
+			float t2 = (node.max[k] - o[k]) * inv_dir[k];
+			if (t1 > t2) { float tmp = t1; t1 = t2; t2 = tmp; }
+			//NaN from 0 * inf (segment in slab plane) is ignored by these comparisons
+			if (t1 > t_min) t_min = t1;
+			if (t2 < t_max) t_max = t2;
+			if (t_min > t_max) return false;
+		}
+		t_enter = t_min;
+		return true;
+	}
+};
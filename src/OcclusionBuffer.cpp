@@ -0,0 +1,183 @@
+#include "OcclusionBuffer.h"
+#include <algorithm>
+#include <cfloat>
+#if defined(LM_SSE)
+#include <xmmintrin.h>
+#endif
+
+using namespace lm;
+
+void OcclusionBuffer::init(int width, int height) {
+	tiles_x_ = (width + TILE_SIZE - 1) / TILE_SIZE;
+	tiles_y_ = (height + TILE_SIZE - 1) / TILE_SIZE;
+	width_ = tiles_x_ * TILE_SIZE;
+	height_ = tiles_y_ * TILE_SIZE;
+	depth_.assign(width_ * height_, 1.0f);
+	tile_max_.assign(tiles_x_ * tiles_y_, 1.0f);
+}
+
+void OcclusionBuffer::clear(const mat4& view_projection) {
+	view_projection_ = view_projection;
+	std::fill(depth_.begin(), depth_.end(), 1.0f);
+	std::fill(tile_max_.begin(), tile_max_.end(), 1.0f);
+}
+
+//clip space to pixel coordinates, and depth from 0 to 1
+vec3 OcclusionBuffer::toScreen_(const vec4& clip) const {
+	float inv_w = 1.0f / clip.w;
+	return vec3((clip.x * inv_w * 0.5f + 0.5f) * width_,
+		(clip.y * inv_w * 0.5f + 0.5f) * height_,
+		clip.z * inv_w * 0.5f + 0.5f);
+}
+
+// ****** OCCLUDERS ***** //
+
+void OcclusionBuffer::drawOccluder(const OccluderMesh& mesh, const mat4& model) {
+	size_t num_vertices = mesh.vertices.size();
+	clip_vertices_.resize(num_vertices);
+	transformPoints(view_projection_ * model, mesh.vertices.data(), clip_vertices_.data(), num_vertices);
+
+	for (size_t i = 0; i + 2 < mesh.indices.size(); i += 3) {
+		const vec4& a = clip_vertices_[mesh.indices[i]];
+		const vec4& b = clip_vertices_[mesh.indices[i + 1]];
+		const vec4& c = clip_vertices_[mesh.indices[i + 2]];
+		//behind near plane, so would need clipping
+		if (a.z < -a.w || b.z < -b.w || c.z < -c.w || a.w <= 0.0f || b.w <= 0.0f || c.w <= 0.0f)
+			continue;
+		drawTriangle_(toScreen_(a), toScreen_(b), toScreen_(c));
+	}
+}
+
+//edge function, positive if p is left of u -> v
+static float edge(const vec3& u, const vec3& v, float px, float py) {
+	return (v.x - u.x) * (py - u.y) - (v.y - u.y) * (px - u.x);
+}
+
+//fills pixels whose centers are inside the triangle. Each edge function is
+//linear in x, so a row is walked by adding its x step, four pixels at a time
+void OcclusionBuffer::drawTriangle_(const vec3& a, const vec3& in_b, const vec3& in_c) {
+	//wind triangle so that inside is where all edge functions are positive,
+	//as occluders are drawn from both sides
+	vec3 b = in_b, c = in_c;
+	float area = edge(a, b, c.x, c.y);
+	if (area == 0.0f) return;
+	if (area < 0.0f) { vec3 t = b; b = c; c = t; area = -area; }
+	float inv_area = 1.0f / area;
+
+	//pixels whose centers lie within the triangle's bounds
+	float min_x = fmin(a.x, fmin(b.x, c.x)), max_x = fmax(a.x, fmax(b.x, c.x));
+	float min_y = fmin(a.y, fmin(b.y, c.y)), max_y = fmax(a.y, fmax(b.y, c.y));
+	int x0 = (int)ceilf(min_x - 0.5f), x1 = (int)floorf(max_x - 0.5f);
+	int y0 = (int)ceilf(min_y - 0.5f), y1 = (int)floorf(max_y - 0.5f);
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > width_ - 1) x1 = width_ - 1;
+	if (y1 > height_ - 1) y1 = height_ - 1;
+	if (x0 > x1 || y0 > y1) return;
+	//rows are walked in groups of four aligned pixels, which never leave the
+	//row as the width is a multiple of the tile size
+	x0 &= ~3;
+
+	//x steps of edge functions w0 (opposite a), w1 (opposite b), w2 (opposite c)
+	float step0 = -(c.y - b.y), step1 = -(a.y - c.y), step2 = -(b.y - a.y);
+
+	for (int y = y0; y <= y1; y++) {
+		float py = y + 0.5f, px = x0 + 0.5f;
+		float w0 = edge(b, c, px, py), w1 = edge(c, a, px, py), w2 = edge(a, b, px, py);
+		float* row = &depth_[y * width_];
+#if defined(LM_SSE)
+		const __m128 offsets = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+		__m128 e0 = _mm_add_ps(_mm_set1_ps(w0), _mm_mul_ps(offsets, _mm_set1_ps(step0)));
+		__m128 e1 = _mm_add_ps(_mm_set1_ps(w1), _mm_mul_ps(offsets, _mm_set1_ps(step1)));
+		__m128 e2 = _mm_add_ps(_mm_set1_ps(w2), _mm_mul_ps(offsets, _mm_set1_ps(step2)));
+		const __m128 e0_step = _mm_set1_ps(step0 * 4.0f), e1_step = _mm_set1_ps(step1 * 4.0f), e2_step = _mm_set1_ps(step2 * 4.0f);
+		const __m128 az = _mm_set1_ps(a.z * inv_area), bz = _mm_set1_ps(b.z * inv_area), cz = _mm_set1_ps(c.z * inv_area);
+		const __m128 zero = _mm_setzero_ps();
+		for (int x = x0; x <= x1; x += 4) {
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+			if (_mm_movemask_ps(inside)) {
+				__m128 z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e0, az), _mm_mul_ps(e1, bz)), _mm_mul_ps(e2, cz));
+				__m128 old_z = _mm_loadu_ps(row + x);
+				__m128 new_z = _mm_min_ps(old_z, z);
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, new_z), _mm_andnot_ps(inside, old_z)));
+			}
+			e0 = _mm_add_ps(e0, e0_step);
+			e1 = _mm_add_ps(e1, e1_step);
+			e2 = _mm_add_ps(e2, e2_step);
+		}
+#else
+		for (int x = x0; x <= x1; x++) {
+			if (w0 >= 0.0f && w1 >= 0.0f && w2 >= 0.0f) {
+				float z = (w0 * a.z + w1 * b.z + w2 * c.z) * inv_area;
+				if (z < row[x]) row[x] = z;
+			}
+			w0 += step0;
+			w1 += step1;
+			w2 += step2;
+		}
+#endif
+	}
+}
+
+void OcclusionBuffer::buildHiZ() {
+	for (int ty = 0; ty < tiles_y_; ty++) {
+		for (int tx = 0; tx < tiles_x_; tx++) {
+			float tile_max = 0.0f;
+			for (int y = ty * TILE_SIZE; y < (ty + 1) * TILE_SIZE; y++) {
+				const float* row = &depth_[y * width_ + tx * TILE_SIZE];
+				for (int x = 0; x < TILE_SIZE; x++)
+					if (row[x] > tile_max) tile_max = row[x];
+			}
+			tile_max_[ty * tiles_x_ + tx] = tile_max;
+		}
+	}
+}
+
+// ****** TESTS ***** //
+
+//the box covers the screen rectangle around its projected corners, and no
+//point of it is nearer than its nearest corner
+bool OcclusionBuffer::testAABB(const vec3& min, const vec3& max) const {
+	vec4 corners[8], clip[8];
+	for (int i = 0; i < 8; i++)
+		corners[i] = vec4(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z, 1.0f);
+	transformPoints(view_projection_, corners, clip, 8);
+
+	float min_x = FLT_MAX, min_y = FLT_MAX, min_z = FLT_MAX;
+	float max_x = -FLT_MAX, max_y = -FLT_MAX;
+	for (int i = 0; i < 8; i++) {
+		//box crosses the near plane, so it can't be projected
+		if (clip[i].w <= 0.0f || clip[i].z < -clip[i].w) return true;
+		vec3 p = toScreen_(clip[i]);
+		if (p.x < min_x) min_x = p.x;
+		if (p.y < min_y) min_y = p.y;
+		if (p.z < min_z) min_z = p.z;
+		if (p.x > max_x) max_x = p.x;
+		if (p.y > max_y) max_y = p.y;
+	}
+
+	int x0 = (int)floorf(min_x), x1 = (int)floorf(max_x);
+	int y0 = (int)floorf(min_y), y1 = (int)floorf(max_y);
+	if (x0 < 0) x0 = 0;
+	if (y0 < 0) y0 = 0;
+	if (x1 > width_ - 1) x1 = width_ - 1;
+	if (y1 > height_ - 1) y1 = height_ - 1;
+	if (x0 > x1 || y0 > y1) return true;
+
+	for (int ty = y0 / TILE_SIZE; ty <= y1 / TILE_SIZE; ty++) {
+		for (int tx = x0 / TILE_SIZE; tx <= x1 / TILE_SIZE; tx++) {
+			//every pixel in tile is nearer than the box
+			if (tile_max_[ty * tiles_x_ + tx] < min_z) continue;
+			int py0 = ty * TILE_SIZE > y0 ? ty * TILE_SIZE : y0;
+			int py1 = (ty + 1) * TILE_SIZE - 1 < y1 ? (ty + 1) * TILE_SIZE - 1 : y1;
+			int px0 = tx * TILE_SIZE > x0 ? tx * TILE_SIZE : x0;
+			int px1 = (tx + 1) * TILE_SIZE - 1 < x1 ? (tx + 1) * TILE_SIZE - 1 : x1;
+			for (int y = py0; y <= py1; y++) {
+				const float* row = &depth_[y * width_];
+				for (int x = px0; x <= px1; x++)
+					if (row[x] >= min_z) return true;
+			}
+		}
+	}
+	return false;
+}
@@ -0,0 +1,54 @@
+#pragma once
+#include "linmath.h"
+#include <vector>
+
+//copy of a geometry's triangles kept on the CPU, so it can be drawn into an
+//OcclusionBuffer. Vertices have w = 1, ready to be transformed in one batch
+struct OccluderMesh {
+	std::vector<lm::vec4> vertices;
+	std::vector<unsigned int> indices;
+};
+
+//low resolution depth buffer rasterized on the CPU from a few large occluder
+//meshes, such as walls and floors. Bounding boxes of other meshes are tested
+//against it, to skip those hidden behind the occluders. Depth is stored per
+//pixel, and the furthest depth of each tile of pixels is kept as a coarser
+//level, so most boxes are accepted or rejected without reading single pixels.
+//Makes no GL calls, see tests/occlusion_buffer_check.cpp
+class OcclusionBuffer {
+public:
+	static const int TILE_SIZE = 8;
+
+	//width and height are rounded up to a multiple of the tile size
+	void init(int width, int height);
+	//clears depth to the far plane and sets the matrix used by the next
+	//draws and tests
+	void clear(const lm::mat4& view_projection);
+	//rasterizes the triangles of mesh, transformed by model, keeping the
+	//nearest depth of each pixel. Triangles crossing the near plane are
+	//skipped, which can only make the buffer hide less
+	void drawOccluder(const OccluderMesh& mesh, const lm::mat4& model);
+	//updates the tile level, call after drawing all occluders
+	void buildHiZ();
+	//returns false only if every pixel covered by the box has an occluder
+	//nearer than the nearest point of the box. Safe to call from several threads
+	bool testAABB(const lm::vec3& min, const lm::vec3& max) const;
+
+	int getWidth() const { return width_; }
+	int getHeight() const { return height_; }
+	const float* getDepth() const { return depth_.data(); }
+
+private:
+	int width_ = 0;
+	int height_ = 0;
+	int tiles_x_ = 0;
+	int tiles_y_ = 0;
+	std::vector<float> depth_; //0 is near plane, 1 far plane
+	std::vector<float> tile_max_; //furthest depth in each tile
+	lm::mat4 view_projection_;
+	std::vector<lm::vec4> clip_vertices_; //occluder vertices of the current draw
+
+	//x and y are in pixels, z is depth
+	void drawTriangle_(const lm::vec3& a, const lm::vec3& b, const lm::vec3& c);
+	lm::vec3 toScreen_(const lm::vec4& clip) const;
+};
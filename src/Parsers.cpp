@@ -316,7 +316,8 @@ GLuint Parsers::parseCubemap(std::vector<std::string>& faces) {
 }
 
 bool Parsers::parseJSONLevel(std::string filename,
-                             GraphicsSystem& graphics_system, ControlSystem& control_system) {
+                             GraphicsSystem& graphics_system, ControlSystem& control_system,
+                             CollisionSystem& collision_system) {
     //read json file and stream it into a rapidjson document
     //see http://rapidjson.org/md_doc_stream.html
     std::ifstream json_file(filename);
@@ -341,6 +342,8 @@ bool Parsers::parseJSONLevel(std::string filename,
     
     //dictionaries
     std::unordered_map<std::string, int> geometries;
+    std::unordered_map<std::string, std::string> geometry_files;
+    std::unordered_map<std::string, int> mesh_bvhs; //by file, so entities share them
     std::unordered_map<std::string, GLuint> textures;
     std::unordered_map<std::string, int> materials;
     std::unordered_map<std::string, int> shaders;
@@ -355,6 +358,7 @@ bool Parsers::parseJSONLevel(std::string filename,
         int geom_id = graphics_system.createGeometryFromFile(data_dir + file);
         //add to dictionary
         geometries[name] = geom_id;
+        geometry_files[name] = data_dir + file;
     }
     
     //shaders
@@ -483,6 +487,11 @@ bool Parsers::parseJSONLevel(std::string filename,
         else
             graphics_system.getMaterial(mat_id).ambient = lm::vec3(0.1f, 0.1f, 0.1f); //no specular
         
+        //opacity, below 1 is drawn in transparent pass
+        if (json["materials"][i].HasMember("opacity")) {
+            graphics_system.getMaterial(mat_id).opacity = json["materials"][i]["opacity"].GetFloat();
+        }
+        
         //reflection
         if (json["materials"][i].HasMember("cube_map")) {
             std::string cube_map = json["materials"][i]["cube_map"].GetString();
@@ -560,6 +569,8 @@ bool Parsers::parseJSONLevel(std::string filename,
         Mesh& ent_mesh = ECS.createComponentForEntity<Mesh>(ent_id);
         ent_mesh.geometry = geometries[json_geometry];
         ent_mesh.material = materials[json_material];
+        if (json_ent.HasMember("occluder")) ent_mesh.occluder = json_ent["occluder"].GetBool();
+        if (ent_mesh.occluder) graphics_system.prepareOccluder(ent_mesh.geometry);
         
         //transform
         auto& ent_transform = ECS.getComponentFromEntity<Transform>(ent_id);
@@ -575,6 +586,7 @@ bool Parsers::parseJSONLevel(std::string filename,
         
         //scale
         ent_transform.scaleLocal(js[0].GetFloat(), js[1].GetFloat(), js[2].GetFloat());
+        ent_transform.rigid = js[0].GetFloat() == 1.0f && js[1].GetFloat() == 1.0f && js[2].GetFloat() == 1.0f;
         //translate
         ent_transform.translate(jt[0].GetFloat(), jt[1].GetFloat(), jt[2].GetFloat());
         
@@ -602,24 +614,47 @@ bool Parsers::parseJSONLevel(std::string filename,
                 box_collider.local_halfwidth.y = json_col_halfwidth[1].GetFloat();
                 box_collider.local_halfwidth.z = json_col_halfwidth[2].GetFloat();
             }
+            if (coll_type == "Sphere") {
+                Collider& sphere_collider = ECS.createComponentForEntity<Collider>(ent_id);
+                sphere_collider.collider_type = ColliderTypeSphere;
+                
+                auto json_col_center = json_ent["collider"]["center"].GetArray();
+                sphere_collider.local_center.x = json_col_center[0].GetFloat();
+                sphere_collider.local_center.y = json_col_center[1].GetFloat();
+                sphere_collider.local_center.z = json_col_center[2].GetFloat();
+                
+                sphere_collider.radius = json_ent["collider"]["radius"].GetFloat();
+            }
+            if (coll_type == "Mesh") {
+                //collides with the entity's geometry, or with another OBJ if given
+                std::string mesh_file = geometry_files[json_geometry];
+                if (json_ent["collider"].HasMember("file"))
+                    mesh_file = data_dir + json_ent["collider"]["file"].GetString();
+                if (mesh_bvhs.find(mesh_file) == mesh_bvhs.end())
+                    mesh_bvhs[mesh_file] = collision_system.loadMeshBVH(mesh_file);
+                
+                if (mesh_bvhs[mesh_file] >= 0) {
+                    Collider& mesh_collider = ECS.createComponentForEntity<Collider>(ent_id);
+                    mesh_collider.collider_type = ColliderTypeMesh;
+                    mesh_collider.mesh_bvh = mesh_bvhs[mesh_file];
+                }
+                else std::cerr << "ERROR: Parser: No mesh collider for entity " << json_name << std::endl;
+            }
             ///TODO - Ray
         }
     }
     
-    //now link hierarchy need to get transform id from parent entity,
-    //and link to transform object from child entity
+    //now link hierarchy, once all parent entities exist
     for (std::pair<std::string, std::string> relationship : child_parent)
     {
         //get parent entity
         int parent_entity_id = ECS.getEntity(relationship.second);
-        Entity& parent = ECS.entities[parent_entity_id];
-        int parent_transform_id = parent.components[0]; //transform component is always in slot 0
         
         //get child transform
         Transform& transform_child = ECS.getComponentFromEntity<Transform>(relationship.first);
         
-        //link child transform with parent id
-        transform_child.parent = parent_transform_id;
+        //link child transform with parent entity
+        transform_child.parent = ECS.getHandle(parent_entity_id);
     }
     
     return true;
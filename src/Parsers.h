@@ -3,6 +3,7 @@
 #include <vector>
 #include "GraphicsSystem.h"
 #include "ControlSystem.h"
+#include "CollisionSystem.h"
 
 struct TGAInfo //stores info about TGA file
 {
@@ -25,5 +26,6 @@ public:
     static GLuint parseCubemap(std::vector<std::string>& faces);
     static bool parseJSONLevel(std::string filename,
                                GraphicsSystem& graphics_system,
-                               ControlSystem& control_system);
+                               ControlSystem& control_system,
+                               CollisionSystem& collision_system);
 };
@@ -0,0 +1,59 @@
+#include "Scheduler.h"
+
+//tasks must be added in the order they would run on a single thread
+void Scheduler::addTask(const std::string& name, AccessMask reads, AccessMask writes, std::function<void(float)> run) {
+	SchedulerTask task;
+	task.name = name;
+	task.reads = reads;
+	task.writes = writes;
+	task.run = run;
+	tasks_.push_back(task);
+	waves_dirty_ = true;
+}
+
+//runs each wave, waiting for all of its tasks before starting the next
+void Scheduler::run(float dt) {
+	if (waves_dirty_) buildWaves_();
+
+	//replays need the single threaded order
+	if (jobs_ && jobs_->isDeterministic()) {
+		for (auto& task : tasks_) task.run(dt);
+		return;
+	}
+
+	const AccessMask gl = resourceMask(RESOURCE_GL);
+	for (auto& wave : waves_) {
+		//send worker tasks first so they overlap with the main thread ones
+		for (int id : wave) {
+			SchedulerTask& task = tasks_[id];
+			if (!((task.reads | task.writes) & gl) && jobs_)
+				jobs_->add([&task, dt] { task.run(dt); });
+		}
+		for (int id : wave) {
+			SchedulerTask& task = tasks_[id];
+			if (((task.reads | task.writes) & gl) || !jobs_)
+				task.run(dt);
+		}
+		if (jobs_) jobs_->wait();
+	}
+}
+
+void Scheduler::buildWaves_() {
+	waves_.clear();
+	std::vector<int> task_wave(tasks_.size(), 0);
+	for (size_t i = 0; i < tasks_.size(); i++) {
+		SchedulerTask& task = tasks_[i];
+		int wave = 0;
+		for (size_t j = 0; j < i; j++) {
+			SchedulerTask& earlier = tasks_[j];
+			bool conflict = (task.writes & (earlier.reads | earlier.writes)) ||
+				(task.reads & earlier.writes);
+			if (conflict && task_wave[j] + 1 > wave)
+				wave = task_wave[j] + 1;
+		}
+		task_wave[i] = wave;
+		if (wave >= (int)waves_.size()) waves_.resize(wave + 1);
+		waves_[wave].push_back((int)i);
+	}
+	waves_dirty_ = false;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include "Components.h"
+#include "JobSystem.h"
+#include <string>
+
+//each task declares what it reads and writes as a bit mask. The first
+//NUM_TYPE_COMPONENTS bits are the component arrays, followed by shared
+//state which isn't stored in components
+typedef unsigned int AccessMask;
+enum SchedulerResource {
+	RESOURCE_INPUT = NUM_TYPE_COMPONENTS, //key and mouse state in ControlSystem
+	RESOURCE_CONTROL, //movement ControlSystem requested from input this frame
+	RESOURCE_WORLD_MATRICES, //world and normal matrices cached by the ECS
+	RESOURCE_RENDER_STATE, //instances and frame data gathered by GraphicsSystem
+	RESOURCE_COLLISION_WORLD, //collider shapes and box tree cached by CollisionSystem
+	RESOURCE_GL, //the GL context. Tasks using it run on the main thread
+	RESOURCE_COUNT
+};
+
+//mask with the bit of each component type in Ts
+template<typename... Ts>
+AccessMask componentMask() {
+	AccessMask mask = 0;
+	int types[] = { 0, type2int<Ts>::result... };
+	for (size_t i = 1; i < sizeof(types) / sizeof(int); i++)
+		mask |= 1u << types[i];
+	return mask;
+}
+
+//mask with the bit of a resource
+inline AccessMask resourceMask(SchedulerResource resource) {
+	return 1u << resource;
+}
+
+//mask with every component type, for tasks which may touch anything
+inline AccessMask allComponentsMask() {
+	return (1u << NUM_TYPE_COMPONENTS) - 1;
+}
+
+struct SchedulerTask {
+	std::string name;
+	AccessMask reads;
+	AccessMask writes;
+	std::function<void(float)> run;
+};
+
+//runs the frame's tasks in waves. A task goes in the wave after the last
+//earlier task it conflicts with (one writes what the other reads or writes),
+//so tasks in the same wave can run at the same time. Tasks using GL run on
+//the calling thread, in the order they were added, the rest go to the job system.
+//In deterministic mode all tasks run on the calling thread in the order added
+class Scheduler {
+public:
+	void init(JobSystem* jobs) { jobs_ = jobs; }
+	void addTask(const std::string& name, AccessMask reads, AccessMask writes, std::function<void(float)> run);
+	void run(float dt);
+
+	//tasks of each wave, as indices in order added
+	const std::vector<std::vector<int>>& getWaves() { if (waves_dirty_) buildWaves_(); return waves_; }
+
+private:
+	JobSystem* jobs_ = nullptr;
+	std::vector<SchedulerTask> tasks_;
+	std::vector<std::vector<int>> waves_;
+	bool waves_dirty_ = true;
+	void buildWaves_();
+};
@@ -20,3 +20,15 @@ void ScriptSystem::registerScript(Script* new_script) {
 
 }
 
+AccessMask ScriptSystem::getReads() const {
+	AccessMask reads = 0;
+	for (auto scr : scripts_) reads |= scr->getReads();
+	return reads;
+}
+
+AccessMask ScriptSystem::getWrites() const {
+	AccessMask writes = 0;
+	for (auto scr : scripts_) writes |= scr->getWrites();
+	return writes;
+}
+
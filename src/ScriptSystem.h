@@ -3,6 +3,7 @@
 #include "Components.h"
 #include <vector>
 #include "ControlSystem.h"
+#include "Scheduler.h"
 
 
 //Forward declare ControlSystem to get input
@@ -22,9 +23,21 @@ public:
 	//sets pointer to control system
 	void setInput(ControlSystem* cont_sys) { input_ = cont_sys; };
 
+	//what update reads and writes, see Scheduler
+	AccessMask getReads() const { return reads_; }
+	AccessMask getWrites() const { return writes_; }
+
 protected:
 	int owner_; //id of entity which owns this script
 	ControlSystem* input_ = nullptr; //pointer to control system
+
+	//derived scripts call this in their constructor to declare what they use.
+	//Until then a script may read input and read or write any component
+	void setAccess(AccessMask reads, AccessMask writes) { reads_ = reads; writes_ = writes; }
+
+private:
+	AccessMask reads_ = resourceMask(RESOURCE_INPUT) | allComponentsMask();
+	AccessMask writes_ = allComponentsMask();
 };
 
 class ScriptSystem {
@@ -42,6 +55,11 @@ public:
 	//register new script
 	void registerScript(Script* new_script);
 
+	//union of what the registered scripts read and write. The scheduler
+	//takes these once, so scripts must be registered before it is set up
+	AccessMask getReads() const;
+	AccessMask getWrites() const;
+
 private:
 	std::vector<Script*> scripts_;
 
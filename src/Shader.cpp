@@ -208,7 +208,9 @@ void Shader::makeShaderProgram(GLuint vertexShaderID,GLuint fragmentShaderID)
     }
     
     //init uniforms
+    initUniformNames_();
     initUniforms_();
+    initUniformBlocks_();
 }
 
 GLint Shader::bindAttribute(const char* attribute_name) {
@@ -220,27 +222,82 @@ GLint Shader::bindAttribute(const char* attribute_name) {
     else return attribute_ID;
 }
 
+//asks the linked program for all its active uniforms and stores their locations
+//by name. Struct members are reported individually (e.g. "u_test.color_a"), as
+//are struct array members (e.g. "lights[0].color"). Arrays of basic types are
+//reported once as "name[0]", so each element, and the bare name, is added here.
+//Uniforms inside a uniform block have no location and are skipped
+void Shader::initUniformNames_() {
+	uniform_name_locations_.clear();
+
+	GLint num_uniforms = 0, max_name_length = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &num_uniforms);
+	glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_name_length);
+	std::vector<GLchar> name_buffer(max_name_length + 1);
+
+	for (GLint i = 0; i < num_uniforms; i++) {
+		GLsizei name_length = 0;
+		GLint array_size = 0;
+		GLenum type;
+		glGetActiveUniform(program, (GLuint)i, (GLsizei)name_buffer.size(), &name_length, &array_size, &type, &name_buffer[0]);
+		std::string name(&name_buffer[0], name_length);
+
+		GLint loc = glGetUniformLocation(program, name.c_str());
+		if (loc == -1) continue; // uniform block member
+
+		uniform_name_locations_[name] = loc;
+
+		//array of basic type
+		size_t bracket = name.rfind("[0]");
+		if (bracket != std::string::npos && bracket + 3 == name.size()) {
+			std::string base_name = name.substr(0, bracket);
+			uniform_name_locations_[base_name] = loc;
+			for (GLint j = 1; j < array_size; j++) {
+				std::string element_name = base_name + "[" + std::to_string(j) + "]";
+				uniform_name_locations_[element_name] = glGetUniformLocation(program, element_name.c_str());
+			}
+		}
+	}
+}
+
 //first initializes uniform location vector, then maps uniform locations
-//to each id, using the 
+//to each id, using the name cache filled by initUniformNames_
 void Shader::initUniforms_() {
     
 	//initialize uniform location vector to all -1 (not found) 
 	uniform_locations_ = std::vector<GLuint>(UNIFORMS_COUNT, -1);
 
-	//iterate map of all possible uniforms, asking shader if it has them
+	//iterate map of all possible uniforms, looking up the ones the shader has
 	for (std::pair<std::string, UniformID> element : uniform_string2id_)
 	{
-		std::string uniform_name = element.first;
-		UniformID uniform_id = element.second;
-		uniform_locations_[uniform_id] = glGetUniformLocation(program, uniform_name.c_str());
+		uniform_locations_[element.second] = getUniformLocation(element.first);
 	}    
 }
 
+//binds every uniform block the shader declares to the binding point
+//given by its enum, so no per-shader uniform buffer setup is needed
+void Shader::initUniformBlocks_() {
+	for (std::pair<std::string, UniformBlockID> element : uniform_block_string2id_)
+	{
+		GLuint block_index = glGetUniformBlockIndex(program, element.first.c_str());
+		if (block_index != GL_INVALID_INDEX)
+			glUniformBlockBinding(program, block_index, element.second);
+	}
+}
+
 //Returns location of uniform with given enum
 GLuint Shader::getUniformLocation(UniformID name) {
 	return uniform_locations_[name];
 }
 
+//Returns location of any uniform by name, or -1 if shader does not have it
+//This is a hash lookup, so in per-frame code prefer to store the result
+GLint Shader::getUniformLocation(const std::string& name) const {
+	auto it = uniform_name_locations_.find(name);
+	if (it == uniform_name_locations_.end()) return -1;
+	return it->second;
+}
+
 
 
 
@@ -22,6 +22,7 @@ enum UniformID {
 	U_SKYBOX,
 	U_USE_REFLECTION_MAP,
 	U_NUM_LIGHTS,
+	U_ICON,
 	UNIFORMS_COUNT
 };
 
@@ -42,7 +43,22 @@ const std::unordered_map<std::string, UniformID> uniform_string2id_ = {
 	{ "u_diffuse_map", U_DIFFUSE_MAP },
 	{ "u_skybox", U_SKYBOX },
 	{ "u_use_reflection_map", U_USE_REFLECTION_MAP },
-	{ "u_num_lights", U_NUM_LIGHTS }
+	{ "u_num_lights", U_NUM_LIGHTS },
+	{ "u_icon", U_ICON }
+};
+
+//Uniform block IDs. Each block is bound to the binding point with the same value,
+//so that buffers bound there by Graphics System are shared by every shader
+enum UniformBlockID {
+	UB_FRAME,
+	UB_MATERIAL,
+	UNIFORM_BLOCKS_COUNT
+};
+
+//maps the uniform block name in GLSL to our enum ID
+const std::unordered_map<std::string, UniformBlockID> uniform_block_string2id_ = {
+	{ "FrameData", UB_FRAME },
+	{ "MaterialData", UB_MATERIAL }
 };
 
 
@@ -50,7 +66,11 @@ class Shader {
 private:
 	//stores, for each uniform enum, it's location
 	std::vector<GLuint> uniform_locations_;
+	//stores location of every active uniform in the program, by name
+	std::unordered_map<std::string, GLint> uniform_name_locations_;
+	void initUniformNames_();
 	void initUniforms_();
+	void initUniformBlocks_();
     
 public:
     GLuint program;
@@ -69,6 +89,7 @@ public:
     
 	//
     GLuint getUniformLocation(UniformID name);
+    GLint getUniformLocation(const std::string& name) const;
     
     bool setUniform(UniformID id, const int data);
     bool setUniform(UniformID id, const float data);
@@ -7,6 +7,11 @@
 #include "linmath.h"
 #include <math.h> //atan2
 #include <utility> //for std::swap
+#if defined(LM_SSE)
+#include <xmmintrin.h>
+#elif defined(LM_NEON)
+#include <arm_neon.h>
+#endif
 
 namespace lm {
 
@@ -163,69 +168,127 @@ namespace lm {
 		return *this;
 	}
 
+	// inverse of any invertible matrix by the cofactor method (see Intel's
+	// "Streaming SIMD Extensions - Inverse of 4x4 Matrix"), which works for
+	// column major matrices too as inverse and transpose commute. The SSE and
+	// scalar versions only differ in rounding, as products are summed in a
+	// different order. Returns false and leaves the matrix unchanged if it is singular
+#if defined(LM_SSE)
 	bool mat4::inverse()
 	{
-		unsigned int i, j, k, swap;
-		float t;
-		mat4 temp, final;
-		final.setIdentity();
-
-		temp = (*this);
-
-		unsigned int m, n;
-		m = n = 4;
-
-		for (i = 0; i < m; i++)
-		{
-			// Look for largest element in column
-			swap = i;
-			for (j = i + 1; j < m; j++)// m or n
-			{
-				if (fabs(temp.M[j][i]) > fabs(temp.M[swap][i]))
-					swap = j;
-			}
-
-			if (swap != i)
-			{
-				// Swap rows.
-				for (k = 0; k < n; k++)
-				{
-					std::swap(temp.M[i][k], temp.M[swap][k]);
-					std::swap(final.M[i][k], final.M[swap][k]);
-				}
-			}
-			// No non-zero pivot.  The CMatrix is singular, which shouldn't
-			// happen.  This means the user gave us a bad CMatrix.
-#define MATRIX_SINGULAR_THRESHOLD 0.00001 //change this if you experience problems with matrices
-			if (fabsf(temp.M[i][i]) <= MATRIX_SINGULAR_THRESHOLD)
-			{
-				final.setIdentity();
-				return false;
-			}
-#undef MATRIX_SINGULAR_THRESHOLD
-			t = 1.0f / temp.M[i][i];
-			for (k = 0; k < n; k++)//m or n
-			{
-				temp.M[i][k] *= t;
-				final.M[i][k] *= t;
-			}
-			for (j = 0; j < m; j++) // m or n
-			{
-				if (j != i)
-				{
-					t = temp.M[j][i];
-					for (k = 0; k < n; k++)//m or n
-					{
-						temp.M[j][k] -= (temp.M[i][k] * t);
-						final.M[j][k] -= (final.M[i][k] * t);
-					}
-				}
-			}
-		}
-		*this = final;
-
+		__m128 minor0, minor1, minor2, minor3;
+		__m128 row0, row1, row2, row3;
+		__m128 det, tmp1;
+
+		//load transposed
+		__m128 c0 = _mm_loadu_ps(m), c1 = _mm_loadu_ps(m + 4), c2 = _mm_loadu_ps(m + 8), c3 = _mm_loadu_ps(m + 12);
+		tmp1 = _mm_movelh_ps(c0, c1);
+		row1 = _mm_movelh_ps(c2, c3);
+		row0 = _mm_shuffle_ps(tmp1, row1, 0x88);
+		row1 = _mm_shuffle_ps(row1, tmp1, 0xDD);
+		tmp1 = _mm_movehl_ps(c1, c0);
+		row3 = _mm_movehl_ps(c3, c2);
+		row2 = _mm_shuffle_ps(tmp1, row3, 0x88);
+		row3 = _mm_shuffle_ps(row3, tmp1, 0xDD);
+
+		tmp1 = _mm_mul_ps(row2, row3);
+		tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0xB1);
+		minor0 = _mm_mul_ps(row1, tmp1);
+		minor1 = _mm_mul_ps(row0, tmp1);
+		tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0x4E);
+		minor0 = _mm_sub_ps(_mm_mul_ps(row1, tmp1), minor0);
+		minor1 = _mm_sub_ps(_mm_mul_ps(row0, tmp1), minor1);
+		minor1 = _mm_shuffle_ps(minor1, minor1, 0x4E);
+
+		tmp1 = _mm_mul_ps(row1, row2);
+		tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0xB1);
+		minor0 = _mm_add_ps(_mm_mul_ps(row3, tmp1), minor0);
+		minor3 = _mm_mul_ps(row0, tmp1);
+		tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0x4E);
+		minor0 = _mm_sub_ps(minor0, _mm_mul_ps(row3, tmp1));
+		minor3 = _mm_sub_ps(_mm_mul_ps(row0, tmp1), minor3);
+		minor3 = _mm_shuffle_ps(minor3, minor3, 0x4E);
+
+		tmp1 = _mm_mul_ps(_mm_shuffle_ps(row1, row1, 0x4E), row3);
+		tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0xB1);
+		row2 = _mm_shuffle_ps(row2, row2, 0x4E);
+		minor0 = _mm_add_ps(_mm_mul_ps(row2, tmp1), minor0);
+		minor2 = _mm_mul_ps(row0, tmp1);
+		tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0x4E);
+		minor0 = _mm_sub_ps(minor0, _mm_mul_ps(row2, tmp1));
+		minor2 = _mm_sub_ps(_mm_mul_ps(row0, tmp1), minor2);
+		minor2 = _mm_shuffle_ps(minor2, minor2, 0x4E);
+
+		tmp1 = _mm_mul_ps(row0, row1);
+		tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0xB1);
+		minor2 = _mm_add_ps(_mm_mul_ps(row3, tmp1), minor2);
+		minor3 = _mm_sub_ps(_mm_mul_ps(row2, tmp1), minor3);
+		tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0x4E);
+		minor2 = _mm_sub_ps(_mm_mul_ps(row3, tmp1), minor2);
+		minor3 = _mm_sub_ps(minor3, _mm_mul_ps(row2, tmp1));
+
+		tmp1 = _mm_mul_ps(row0, row3);
+		tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0xB1);
+		minor1 = _mm_sub_ps(minor1, _mm_mul_ps(row2, tmp1));
+		minor2 = _mm_add_ps(_mm_mul_ps(row1, tmp1), minor2);
+		tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0x4E);
+		minor1 = _mm_add_ps(_mm_mul_ps(row2, tmp1), minor1);
+		minor2 = _mm_sub_ps(minor2, _mm_mul_ps(row1, tmp1));
+
+		tmp1 = _mm_mul_ps(row0, row2);
+		tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0xB1);
+		minor1 = _mm_add_ps(_mm_mul_ps(row3, tmp1), minor1);
+		minor3 = _mm_sub_ps(minor3, _mm_mul_ps(row1, tmp1));
+		tmp1 = _mm_shuffle_ps(tmp1, tmp1, 0x4E);
+		minor1 = _mm_sub_ps(minor1, _mm_mul_ps(row3, tmp1));
+		minor3 = _mm_add_ps(_mm_mul_ps(row1, tmp1), minor3);
+
+		//determinant, with exact division rather than the reciprocal estimate
+		det = _mm_mul_ps(row0, minor0);
+		det = _mm_add_ps(_mm_shuffle_ps(det, det, 0x4E), det);
+		det = _mm_add_ss(_mm_shuffle_ps(det, det, 0xB1), det);
+		float d = _mm_cvtss_f32(det);
+		float inv_det = 1.0f / d;
+		if (d == 0.0f || !std::isfinite(inv_det)) return false;
+		det = _mm_set1_ps(inv_det);
+
+		_mm_storeu_ps(m, _mm_mul_ps(det, minor0));
+		_mm_storeu_ps(m + 4, _mm_mul_ps(det, minor1));
+		_mm_storeu_ps(m + 8, _mm_mul_ps(det, minor2));
+		_mm_storeu_ps(m + 12, _mm_mul_ps(det, minor3));
 		return true;
 	}
+#else
+	bool mat4::inverse()
+	{
+		//each element is the cofactor of its transposed position
+		float inv[16];
+		inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+		inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+		inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+		inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+		inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+		inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+		inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+		inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+		inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+		inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+		inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+		inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+		inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+		inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+		inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+		inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+		//same singular test as the SIMD version
+		float d = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+		float inv_det = 1.0f / d;
+		if (d == 0.0f || !std::isfinite(inv_det)) return false;
+
+		for (int i = 0; i < 16; i++) m[i] = inv[i] * inv_det;
+		return true;
+	}
+#endif
 
 	// orthogonalizes right and top vector from the front vector
 	// assumes new, normalized front vector has just been set
@@ -456,16 +519,39 @@ namespace lm {
 		return vec3(v4m.x, v4m.y, v4m.z);
 	}
 
+	// SIMD kernels multiply each column by one component and sum the products
+	// in the same order as the scalar code, without fused multiply-add, so
+	// results are identical to the scalar version
+#if defined(LM_SSE)
+	static inline __m128 mulColumns(const float* m, __m128 x, __m128 y, __m128 z, __m128 w) {
+		__m128 r = _mm_mul_ps(_mm_loadu_ps(m), x);
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m + 4), y));
+		r = _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m + 8), z));
+		return _mm_add_ps(r, _mm_mul_ps(_mm_loadu_ps(m + 12), w));
+	}
+#elif defined(LM_NEON)
+	static inline float32x4_t mulColumns(const float* m, float x, float y, float z, float w) {
+		float32x4_t r = vmulq_n_f32(vld1q_f32(m), x);
+		r = vaddq_f32(r, vmulq_n_f32(vld1q_f32(m + 4), y));
+		r = vaddq_f32(r, vmulq_n_f32(vld1q_f32(m + 8), z));
+		return vaddq_f32(r, vmulq_n_f32(vld1q_f32(m + 12), w));
+	}
+#endif
+
 	// multiplies a vec4 with a mat4
 	vec4 mat4::operator*(const vec4& v) const
 	{
 		vec4 ret;
-
+#if defined(LM_SSE)
+		_mm_storeu_ps(ret.value_, mulColumns(m, _mm_set1_ps(v.x), _mm_set1_ps(v.y), _mm_set1_ps(v.z), _mm_set1_ps(v.w)));
+#elif defined(LM_NEON)
+		vst1q_f32(ret.value_, mulColumns(m, v.x, v.y, v.z, v.w));
+#else
 		ret.x = v.x*m[0] + v.y*m[4] + v.z*m[8] + v.w*m[12];
 		ret.y = v.x*m[1] + v.y*m[5] + v.z*m[9] + v.w*m[13];
 		ret.z = v.x*m[2] + v.y*m[6] + v.z*m[10] + v.w*m[14];
 		ret.w = v.x*m[3] + v.y*m[7] + v.z*m[11] + v.w*m[15];
-
+#endif
 		return ret;
 	}
 
@@ -473,7 +559,18 @@ namespace lm {
 	mat4 mat4::operator*(const mat4& N) const
 	{
 		mat4 result;
-
+#if defined(LM_SSE)
+		//each column of the result is this matrix times a column of N
+		for (int i = 0; i < 4; i++) {
+			const float* n = N.m + i * 4;
+			_mm_storeu_ps(result.m + i * 4, mulColumns(m, _mm_set1_ps(n[0]), _mm_set1_ps(n[1]), _mm_set1_ps(n[2]), _mm_set1_ps(n[3])));
+		}
+#elif defined(LM_NEON)
+		for (int i = 0; i < 4; i++) {
+			const float* n = N.m + i * 4;
+			vst1q_f32(result.m + i * 4, mulColumns(m, n[0], n[1], n[2], n[3]));
+		}
+#else
 		unsigned int i, j, k;
 		for (i = 0; i < 4; i++) //column
 		{
@@ -488,10 +585,108 @@ namespace lm {
 				}
 			}
 		}
+#endif
+		return result;
+	}
+
+	// inverse of rotation R with uniform scale s and translation t is
+	// R^T / s^2 with translation -(R^T / s^2) * t
+	bool mat4::inverseRigid()
+	{
+		float scale_sq = m[0] * m[0] + m[1] * m[1] + m[2] * m[2];
+		if (scale_sq == 0.0f) return false;
+		float inv_scale_sq = 1.0f / scale_sq;
+
+		//transpose upper 3x3 and divide by squared scale
+		mat4 inv;
+		for (int c = 0; c < 3; c++)
+			for (int r = 0; r < 3; r++)
+				inv.m[c * 4 + r] = m[r * 4 + c] * inv_scale_sq;
+
+		//translation
+		vec4 t = inv * vec4(-m[12], -m[13], -m[14], 0.0f);
+		inv.m[12] = t.x; inv.m[13] = t.y; inv.m[14] = t.z;
+		*this = inv;
+		return true;
+	}
+
+	// inverse of the upper 3x3 has the cross products of its columns as rows,
+	// divided by the determinant, and translation is -inverse(3x3) * t
+	bool mat4::affineInverse()
+	{
+		vec3 a(m[0], m[1], m[2]), b(m[4], m[5], m[6]), c(m[8], m[9], m[10]);
+		vec3 bc = b.cross(c), ca = c.cross(a), ab = a.cross(b);
+		float det = a.dot(bc);
+		if (det == 0.0f) return false;
+		float inv_det = 1.0f / det;
+		bc *= inv_det; ca *= inv_det; ab *= inv_det;
+
+		vec3 t(m[12], m[13], m[14]);
+		float inv[16] = {
+			bc.x, ca.x, ab.x, 0.0f,
+			bc.y, ca.y, ab.y, 0.0f,
+			bc.z, ca.z, ab.z, 0.0f,
+			-bc.dot(t), -ca.dot(t), -ab.dot(t), 1.0f };
+		for (int i = 0; i < 16; i++) m[i] = inv[i];
+		return true;
+	}
 
+	// transpose of the inverse above, so the cross products are the columns.
+	// A singular matrix returns its upper 3x3 unchanged
+	mat4 mat4::normalMatrix() const
+	{
+		vec3 a(m[0], m[1], m[2]), b(m[4], m[5], m[6]), c(m[8], m[9], m[10]);
+		vec3 bc = b.cross(c), ca = c.cross(a), ab = a.cross(b);
+		float det = a.dot(bc);
+		if (det != 0.0f) {
+			float inv_det = 1.0f / det;
+			a = bc * inv_det; b = ca * inv_det; c = ab * inv_det;
+		}
+		mat4 result;
+		result.m[0] = a.x; result.m[1] = a.y; result.m[2] = a.z;
+		result.m[4] = b.x; result.m[5] = b.y; result.m[6] = b.z;
+		result.m[8] = c.x; result.m[9] = c.y; result.m[10] = c.z;
 		return result;
 	}
 
+	void transformPoints(const mat4& m, const vec3* in, vec3* out, size_t count)
+	{
+#if defined(LM_SSE)
+		//columns are loaded once for all points
+		__m128 c0 = _mm_loadu_ps(m.m), c1 = _mm_loadu_ps(m.m + 4), c2 = _mm_loadu_ps(m.m + 8), c3 = _mm_loadu_ps(m.m + 12);
+		for (size_t i = 0; i < count; i++) {
+			__m128 r = _mm_mul_ps(c0, _mm_set1_ps(in[i].x));
+			r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_set1_ps(in[i].y)));
+			r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_set1_ps(in[i].z)));
+			r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_set1_ps(1.0f)));
+			//store only three components, as out is packed
+			_mm_storel_pi((__m64*)out[i].value_, r);
+			_mm_store_ss(out[i].value_ + 2, _mm_movehl_ps(r, r));
+		}
+#else
+		for (size_t i = 0; i < count; i++)
+			out[i] = m * in[i];
+#endif
+	}
+
+	void transformPoints(const mat4& m, const vec4* in, vec4* out, size_t count)
+	{
+#if defined(LM_SSE)
+		__m128 c0 = _mm_loadu_ps(m.m), c1 = _mm_loadu_ps(m.m + 4), c2 = _mm_loadu_ps(m.m + 8), c3 = _mm_loadu_ps(m.m + 12);
+		for (size_t i = 0; i < count; i++) {
+			__m128 v = _mm_loadu_ps(in[i].value_);
+			__m128 r = _mm_mul_ps(c0, _mm_shuffle_ps(v, v, 0x00));
+			r = _mm_add_ps(r, _mm_mul_ps(c1, _mm_shuffle_ps(v, v, 0x55)));
+			r = _mm_add_ps(r, _mm_mul_ps(c2, _mm_shuffle_ps(v, v, 0xAA)));
+			r = _mm_add_ps(r, _mm_mul_ps(c3, _mm_shuffle_ps(v, v, 0xFF)));
+			_mm_storeu_ps(out[i].value_, r);
+		}
+#else
+		for (size_t i = 0; i < count; i++)
+			out[i] = m * in[i];
+#endif
+	}
+
 	// turns this matrix into a view matrix
 	void mat4::lookAt(const vec3& eye, const vec3& center, const vec3& up) {
 		//create coordinate system of camera
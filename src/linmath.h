@@ -5,8 +5,20 @@
 //
 #pragma once
 #include <cmath> //for sqrt (square root) function
+#include <cstddef> //for size_t
 #define DEG2RAD 0.0174532925f
 
+//mat4 and vec4 maths use SIMD kernels where the target has them, with the
+//scalar code as fallback. Define LM_NO_SIMD to always use the scalar code.
+//The NEON kernels have not been built on an ARM target yet, so they stay off
+//unless LM_ENABLE_NEON is defined. tests/linmath_simd_check.cpp compares the
+//SIMD build against the scalar one
+#if !defined(LM_NO_SIMD) && (defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1))
+#define LM_SSE
+#elif !defined(LM_NO_SIMD) && defined(LM_ENABLE_NEON) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#define LM_NEON
+#endif
+
 namespace lm {
 
 	class vec2
@@ -57,7 +69,8 @@ namespace lm {
 	// we only really use a vec4 for special cases using homogenous coordinates
 	// so the class is much restricted compared to vec2 and vec3
 	// note: vector is initialised with w set to 1;
-	class vec4
+	// aligned to 16 bytes so it can be loaded into a SIMD register
+	class alignas(16) vec4
 	{
 	public:
 		union {
@@ -96,7 +109,7 @@ namespace lm {
 		void operator *= (float v) { w *= v; x *= v; y *= v; y *= v;  }
 	};
 
-	class mat4 {
+	class alignas(16) mat4 {
 	public:
 		// OpenGL and GLSL by default accept matrices in column-major format.
 		// However, we are used to writing matrices in row-major format.
@@ -109,6 +122,7 @@ namespace lm {
 		// OpenGL expects us to provide the matrix as array of floats
 		// *ordered by columns*:
 		// [1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0,  X, Y, Z, 1]
+		// Each column is aligned to 16 bytes so it can be loaded into a SIMD register
 		union {
 			float M[4][4]; //represent [column][row] of row-major matrix
 			float m[16];
@@ -125,6 +139,15 @@ namespace lm {
 		mat4& setIdentity();
 		mat4& transpose();
 		bool inverse();
+		//faster inverse for matrices made only of rotation, uniform scale and
+		//translation, such as most model matrices. Returns false if scale is zero
+		bool inverseRigid();
+		//inverse for matrices whose bottom row is 0 0 0 1, such as any model
+		//or view matrix. Returns false and leaves matrix unchanged if singular
+		bool affineInverse();
+		//inverse transpose of upper 3x3 of an affine matrix, with no
+		//translation, for transforming normals and directions
+		mat4 normalMatrix() const;
 
 		//get base vectors
 		vec3 right() const { return vec3(m[0], m[1], m[2]); }
@@ -189,4 +212,9 @@ namespace lm {
 	quat operator * (const quat& a, float v);
 	quat operator * (const quat& a, const quat& b);
 
+	//transform count points by m, as m * point with w = 1 for vec3. Same result
+	//as the operators, but faster for many points. in and out may be the same array
+	void transformPoints(const mat4& m, const vec3* in, vec3* out, size_t count);
+	void transformPoints(const mat4& m, const vec4* in, vec4* out, size_t count);
+
 }
\ No newline at end of file
@@ -11,6 +11,8 @@
 Game* GAME = nullptr;
 //initialise global ECS. By including extern.h in any cpp file (NOT .h file!) we can access this variable
 EntityComponentStore ECS;
+//global job system, shared by all systems in the same way
+JobSystem JOBS;
 
 bool glCheckError() {
     GLenum errCode;
@@ -49,10 +51,15 @@ void mouse_button_callback(GLFWwindow* window, int button, int action, int mods)
 	GAME->mouse_button_callback(button, action, mods);
 }
 
-int main(void)
+int main(int argc, char** argv)
 {
     // register the error call-back function before doing anything else
     glfwSetErrorCallback(glfw_error_callback);
+
+	//--deterministic runs all systems and jobs on the main thread in a fixed
+	//order, so replaying recorded input gives the same results each run
+	for (int i = 1; i < argc; i++)
+		if (std::string(argv[i]) == "--deterministic") JOBS.setDeterministic(true);
     
     //create window pointer
     GLFWwindow* window;
@@ -0,0 +1,49 @@
+//
+//  linmath_scalar.cpp
+//
+//  Scalar build of linmath for linmath_simd_check.cpp. The library is
+//  compiled again with SIMD off, in its own namespace so it can be linked
+//  next to the normal build, and wrapped in functions on plain floats
+//
+
+#ifndef LM_NO_SIMD
+#define LM_NO_SIMD
+#endif
+#define lm lm_scalar
+#include "../src/linmath.cpp"
+#undef lm
+
+#include <cstring>
+
+static lm_scalar::mat4 load(const float* m) {
+	lm_scalar::mat4 r;
+	memcpy(r.m, m, sizeof(r.m));
+	return r;
+}
+
+void scalarMultiply(const float* a, const float* b, float* out) {
+	lm_scalar::mat4 r = load(a) * load(b);
+	memcpy(out, r.m, sizeof(r.m));
+}
+
+bool scalarInverse(float* m) {
+	lm_scalar::mat4 r = load(m);
+	bool ok = r.inverse();
+	memcpy(m, r.m, sizeof(r.m));
+	return ok;
+}
+
+bool scalarAffineInverse(float* m) {
+	lm_scalar::mat4 r = load(m);
+	bool ok = r.affineInverse();
+	memcpy(m, r.m, sizeof(r.m));
+	return ok;
+}
+
+void scalarTransformPoints3(const float* m, const float* in, float* out, size_t count) {
+	lm_scalar::transformPoints(load(m), (const lm_scalar::vec3*)in, (lm_scalar::vec3*)out, count);
+}
+
+void scalarTransformPoints4(const float* m, const float* in, float* out, size_t count) {
+	lm_scalar::transformPoints(load(m), (const lm_scalar::vec4*)in, (lm_scalar::vec4*)out, count);
+}
@@ -0,0 +1,142 @@
+//
+//  linmath_simd_check.cpp
+//
+//  Compares the SIMD build of linmath with the scalar one on random
+//  matrices and points, and prints the largest difference of each function.
+//  Returns non zero if any is over tolerance. Build and run from the repo root:
+//
+//    g++ -std=c++14 -O2 -Isrc tests/linmath_simd_check.cpp tests/linmath_scalar.cpp src/linmath.cpp -o linmath_check
+//    ./linmath_check
+//
+//  With MSVC, compile the same three files with cl /EHsc /O2 /Isrc
+//
+
+#include "linmath.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if !defined(LM_SSE) && !defined(LM_NEON)
+#pragma message("linmath has no SIMD kernels for this target, both builds are scalar")
+#endif
+
+//scalar build, see linmath_scalar.cpp
+void scalarMultiply(const float* a, const float* b, float* out);
+bool scalarInverse(float* m);
+bool scalarAffineInverse(float* m);
+void scalarTransformPoints3(const float* m, const float* in, float* out, size_t count);
+void scalarTransformPoints4(const float* m, const float* in, float* out, size_t count);
+
+using namespace lm;
+
+const int NUM_TESTS = 10000;
+const int NUM_POINTS = 64;
+
+//multiply and transformPoints sum the same products in the same order, so
+//only allow for the compiler contracting the scalar code. The inverses sum
+//cofactors in a different order, and are compared relative to their size.
+//Inverting a perspective with planes at 0.1 and 1000 is off by about 4e-4
+//from a double precision inverse in either build, so they can differ that much
+const float PRODUCT_TOLERANCE = 1e-6f;
+const float INVERSE_TOLERANCE = 1e-3f;
+
+static float randomFloat(float min, float max) {
+	return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+//rotation, non uniform scale and translation, as in a model matrix
+static mat4 randomAffine() {
+	mat4 r;
+	r.makeRotationMatrix(randomFloat(0.0f, 6.28f), vec3(randomFloat(-1, 1), randomFloat(-1, 1), randomFloat(0.1f, 1)).normalize());
+	r.scale(randomFloat(0.2f, 5.0f), randomFloat(0.2f, 5.0f), randomFloat(0.2f, 5.0f));
+	r.m[12] = randomFloat(-100, 100); r.m[13] = randomFloat(-100, 100); r.m[14] = randomFloat(-100, 100);
+	return r;
+}
+
+//affine matrix followed by a perspective, as in a model view projection
+static mat4 randomProjective() {
+	mat4 p;
+	p.perspective(randomFloat(30.0f, 90.0f) * DEG2RAD, randomFloat(0.5f, 2.0f), 0.1f, 1000.0f);
+	return p * randomAffine();
+}
+
+//largest difference between a and b, relative to the largest element of b
+//when it is over one
+static float difference(const float* a, const float* b, int count) {
+	float max_diff = 0.0f, max_value = 1.0f;
+	for (int i = 0; i < count; i++) {
+		if (fabsf(a[i] - b[i]) > max_diff) max_diff = fabsf(a[i] - b[i]);
+		if (fabsf(b[i]) > max_value) max_value = fabsf(b[i]);
+	}
+	return max_diff / max_value;
+}
+
+static bool report(const char* name, float max_diff, float tolerance) {
+	bool ok = max_diff <= tolerance;
+	printf("%-20s max difference %g (tolerance %g) %s\n", name, max_diff, tolerance, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+int main() {
+	srand(1);
+	float multiply_diff = 0.0f, inverse_diff = 0.0f, affine_diff = 0.0f;
+	float points3_diff = 0.0f, points4_diff = 0.0f;
+	int singular_mismatches = 0;
+
+	vec3 in3[NUM_POINTS], out3[NUM_POINTS], scalar_out3[NUM_POINTS];
+	vec4 in4[NUM_POINTS], out4[NUM_POINTS], scalar_out4[NUM_POINTS];
+
+	for (int t = 0; t < NUM_TESTS; t++) {
+		mat4 a = randomProjective(), b = randomAffine();
+		float scalar[16];
+
+		mat4 product = a * b;
+		scalarMultiply(a.m, b.m, scalar);
+		float d = difference(product.m, scalar, 16);
+		if (d > multiply_diff) multiply_diff = d;
+
+		mat4 inv = a;
+		memcpy(scalar, a.m, sizeof(scalar));
+		if (inv.inverse() != scalarInverse(scalar)) singular_mismatches++;
+		d = difference(inv.m, scalar, 16);
+		if (d > inverse_diff) inverse_diff = d;
+
+		mat4 affine_inv = b;
+		memcpy(scalar, b.m, sizeof(scalar));
+		if (affine_inv.affineInverse() != scalarAffineInverse(scalar)) singular_mismatches++;
+		d = difference(affine_inv.m, scalar, 16);
+		if (d > affine_diff) affine_diff = d;
+
+		for (int i = 0; i < NUM_POINTS; i++) {
+			in3[i] = vec3(randomFloat(-100, 100), randomFloat(-100, 100), randomFloat(-100, 100));
+			in4[i] = vec4(in3[i].x, in3[i].y, in3[i].z, 1.0f);
+		}
+		transformPoints(a, in3, out3, NUM_POINTS);
+		scalarTransformPoints3(a.m, in3[0].value_, scalar_out3[0].value_, NUM_POINTS);
+		transformPoints(a, in4, out4, NUM_POINTS);
+		scalarTransformPoints4(a.m, in4[0].value_, scalar_out4[0].value_, NUM_POINTS);
+		for (int i = 0; i < NUM_POINTS; i++) {
+			d = difference(out3[i].value_, scalar_out3[i].value_, 3);
+			if (d > points3_diff) points3_diff = d;
+			d = difference(out4[i].value_, scalar_out4[i].value_, 4);
+			if (d > points4_diff) points4_diff = d;
+		}
+	}
+
+	//both builds must reject the same singular matrices
+	mat4 singular;
+	singular.makeScaleMatrix(1.0f, 0.0f, 1.0f);
+	float scalar[16];
+	memcpy(scalar, singular.m, sizeof(scalar));
+	if (singular.inverse() || scalarInverse(scalar)) singular_mismatches++;
+
+	bool ok = true;
+	ok &= report("operator*", multiply_diff, PRODUCT_TOLERANCE);
+	ok &= report("inverse", inverse_diff, INVERSE_TOLERANCE);
+	ok &= report("affineInverse", affine_diff, INVERSE_TOLERANCE);
+	ok &= report("transformPoints vec3", points3_diff, PRODUCT_TOLERANCE);
+	ok &= report("transformPoints vec4", points4_diff, PRODUCT_TOLERANCE);
+	printf("%-20s %d\n", "singular mismatches", singular_mismatches);
+	ok &= singular_mismatches == 0;
+	return ok ? 0 : 1;
+}
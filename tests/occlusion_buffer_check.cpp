@@ -0,0 +1,146 @@
+//
+//  occlusion_buffer_check.cpp
+//
+//  Checks the CPU occlusion buffer without a GPU: boxes behind, in front of
+//  and beside an occluder wall, then the SIMD rasterizer against the scalar
+//  one on random triangles. Returns non zero on failure. Build and run from
+//  the repo root:
+//
+//    g++ -std=c++14 -O2 -Isrc tests/occlusion_buffer_check.cpp tests/occlusion_scalar.cpp src/OcclusionBuffer.cpp src/linmath.cpp -o occlusion_check
+//    ./occlusion_check
+//
+//  With MSVC, compile the same four files with cl /EHsc /O2 /Isrc
+//
+
+#include "OcclusionBuffer.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+#if !defined(LM_SSE)
+#pragma message("OcclusionBuffer has no SIMD rasterizer for this target, both builds are scalar")
+#endif
+
+using namespace lm;
+
+//scalar build, see occlusion_scalar.cpp
+void scalarOcclusionInit(int width, int height);
+void scalarOcclusionClear(const mat4& view_projection);
+void scalarOcclusionDraw(const OccluderMesh& mesh, const mat4& model);
+void scalarOcclusionBuildHiZ();
+bool scalarOcclusionTest(const vec3& min, const vec3& max);
+const float* scalarOcclusionDepth();
+
+const int WIDTH = 256;
+const int HEIGHT = 128;
+const int NUM_RANDOM_FRAMES = 200;
+const int NUM_RANDOM_BOXES = 200;
+
+//the scalar rasterizer adds the x steps of its edge functions one pixel at a
+//time and the SIMD one four at a time, so depth drifts a little between them
+//along long rows, and pixels whose center lies on an edge may be covered by
+//only one of them
+const float DEPTH_TOLERANCE = 1e-3f;
+const float MAX_EDGE_PIXELS = 0.002f; //fraction of pixels
+const float MAX_TEST_MISMATCHES = 0.01f; //fraction of box tests
+
+static float randomFloat(float min, float max) {
+	return min + (max - min) * (rand() / (float)RAND_MAX);
+}
+
+//square in the xy plane from -1 to 1, facing +z
+static OccluderMesh makeQuad() {
+	OccluderMesh quad;
+	quad.vertices = { vec4(-1, -1, 0, 1), vec4(1, -1, 0, 1), vec4(1, 1, 0, 1), vec4(-1, 1, 0, 1) };
+	quad.indices = { 0, 1, 2, 0, 2, 3 };
+	return quad;
+}
+
+//camera at the origin looking down -z
+static mat4 makeViewProjection() {
+	mat4 view, projection;
+	view.lookAt(vec3(0, 0, 0), vec3(0, 0, -1), vec3(0, 1, 0));
+	projection.perspective(60.0f * DEG2RAD, (float)WIDTH / HEIGHT, 0.1f, 100.0f);
+	return projection * view;
+}
+
+static bool expect(const char* name, bool visible, bool expected) {
+	bool ok = visible == expected;
+	printf("%-28s %-8s %s\n", name, visible ? "visible" : "hidden", ok ? "ok" : "FAILED");
+	return ok;
+}
+
+//a 4 x 4 wall 10 units in front of the camera
+static bool checkWall() {
+	OcclusionBuffer buffer;
+	buffer.init(WIDTH, HEIGHT);
+	buffer.clear(makeViewProjection());
+	mat4 wall;
+	wall.makeScaleMatrix(2.0f, 2.0f, 1.0f);
+	wall.position(0.0f, 0.0f, -10.0f);
+	buffer.drawOccluder(makeQuad(), wall);
+	buffer.buildHiZ();
+
+	bool ok = true;
+	ok &= expect("box behind wall", buffer.testAABB(vec3(-0.5f, -0.5f, -20.0f), vec3(0.5f, 0.5f, -19.0f)), false);
+	ok &= expect("box in front of wall", buffer.testAABB(vec3(-0.5f, -0.5f, -6.0f), vec3(0.5f, 0.5f, -5.0f)), true);
+	ok &= expect("box beside wall", buffer.testAABB(vec3(6.0f, -0.5f, -20.0f), vec3(7.0f, 0.5f, -19.0f)), true);
+	ok &= expect("box behind wall's edge", buffer.testAABB(vec3(3.0f, -0.5f, -20.0f), vec3(5.0f, 0.5f, -19.0f)), true);
+	ok &= expect("box through wall", buffer.testAABB(vec3(-0.5f, -0.5f, -12.0f), vec3(0.5f, 0.5f, -8.0f)), true);
+	ok &= expect("box behind camera", buffer.testAABB(vec3(-0.5f, -0.5f, 1.0f), vec3(0.5f, 0.5f, 2.0f)), true);
+	return ok;
+}
+
+//random occluders drawn by both rasterizers, comparing depth and box tests
+static bool checkSIMD() {
+	OcclusionBuffer buffer;
+	buffer.init(WIDTH, HEIGHT);
+	scalarOcclusionInit(WIDTH, HEIGHT);
+	mat4 view_projection = makeViewProjection();
+	OccluderMesh quad = makeQuad();
+
+	float max_depth_diff = 0.0f;
+	long edge_pixels = 0, test_mismatches = 0;
+	for (int frame = 0; frame < NUM_RANDOM_FRAMES; frame++) {
+		buffer.clear(view_projection);
+		scalarOcclusionClear(view_projection);
+		for (int k = 0; k < 8; k++) {
+			mat4 model;
+			model.makeRotationMatrix(randomFloat(0.0f, 6.28f), vec3(randomFloat(-1, 1), randomFloat(-1, 1), 1).normalize());
+			model.scale(randomFloat(0.5f, 4.0f), randomFloat(0.5f, 4.0f), 1.0f);
+			model.position(randomFloat(-10, 10), randomFloat(-5, 5), randomFloat(-30, -5));
+			buffer.drawOccluder(quad, model);
+			scalarOcclusionDraw(quad, model);
+		}
+		buffer.buildHiZ();
+		scalarOcclusionBuildHiZ();
+
+		const float* depth = buffer.getDepth();
+		const float* scalar_depth = scalarOcclusionDepth();
+		for (int i = 0; i < WIDTH * HEIGHT; i++) {
+			bool covered = depth[i] < 1.0f, scalar_covered = scalar_depth[i] < 1.0f;
+			if (covered != scalar_covered) edge_pixels++;
+			else if (fabsf(depth[i] - scalar_depth[i]) > max_depth_diff) max_depth_diff = fabsf(depth[i] - scalar_depth[i]);
+		}
+
+		for (int b = 0; b < NUM_RANDOM_BOXES; b++) {
+			vec3 min(randomFloat(-12, 12), randomFloat(-6, 6), randomFloat(-40, -3));
+			vec3 max = min + vec3(randomFloat(0.1f, 2.0f), randomFloat(0.1f, 2.0f), randomFloat(0.1f, 2.0f));
+			if (buffer.testAABB(min, max) != scalarOcclusionTest(min, max)) test_mismatches++;
+		}
+	}
+
+	float edge_fraction = edge_pixels / (float)(NUM_RANDOM_FRAMES * WIDTH * HEIGHT);
+	float mismatch_fraction = test_mismatches / (float)(NUM_RANDOM_FRAMES * NUM_RANDOM_BOXES);
+	bool ok = max_depth_diff <= DEPTH_TOLERANCE && edge_fraction <= MAX_EDGE_PIXELS && mismatch_fraction <= MAX_TEST_MISMATCHES;
+	printf("SIMD against scalar: depth difference %g, edge pixels %g, box test mismatches %g %s\n",
+		max_depth_diff, edge_fraction, mismatch_fraction, ok ? "ok" : "FAILED");
+	return ok;
+}
+
+int main() {
+	srand(1);
+	bool ok = checkWall();
+	ok &= checkSIMD();
+	return ok ? 0 : 1;
+}
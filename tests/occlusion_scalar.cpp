@@ -0,0 +1,23 @@
+//
+//  occlusion_scalar.cpp
+//
+//  Scalar build of OcclusionBuffer for occlusion_buffer_check.cpp. The
+//  rasterizer is compiled again with SIMD off, under another class name so
+//  it can be linked next to the normal build, and wrapped in functions
+//
+
+#ifndef LM_NO_SIMD
+#define LM_NO_SIMD
+#endif
+#define OcclusionBuffer ScalarOcclusionBuffer
+#include "../src/OcclusionBuffer.cpp"
+#undef OcclusionBuffer
+
+static ScalarOcclusionBuffer buffer;
+
+void scalarOcclusionInit(int width, int height) { buffer.init(width, height); }
+void scalarOcclusionClear(const mat4& view_projection) { buffer.clear(view_projection); }
+void scalarOcclusionDraw(const OccluderMesh& mesh, const mat4& model) { buffer.drawOccluder(mesh, model); }
+void scalarOcclusionBuildHiZ() { buffer.buildHiZ(); }
+bool scalarOcclusionTest(const vec3& min, const vec3& max) { return buffer.testAABB(min, max); }
+const float* scalarOcclusionDepth() { return buffer.getDepth(); }